@@ -0,0 +1,403 @@
+#pragma once
+
+#include "ComponentSystem.h"
+
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+#define ECS_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// kernels for instruction sets above compiler's baseline are compiled per function
+#if defined( ECS_SIMD_X86 ) && defined( __GNUC__ )
+#define ECS_TARGET_SSE41	__attribute__(( target( "sse4.1" ) ))
+#define ECS_TARGET_AVX2		__attribute__(( target( "avx2" ) ))
+#else
+#define ECS_TARGET_SSE41
+#define ECS_TARGET_AVX2
+#endif
+
+#define COLUMN_ALIGNMENT	32	// bytes, one AVX2 register
+
+typedef int column_t;
+
+enum SimdLevel {
+	SIMD_SCALAR = 0,
+	SIMD_SSE41,
+	SIMD_AVX2
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Bulk integer kernels over whole columns. Instruction set is detected once at runtime, each
+/// 	call runs widest supported kernel, AVX2 (8 lanes), SSE4.1 (4 lanes) or scalar, and finishes
+/// 	tail of column with scalar code. Source column may be given as pointer, or as single value
+/// 	broadcast to every lane.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ColumnKernels {
+	// integer math wraps around in every kernel, scalar one computes in unsigned to match vector ones
+	struct OpAdd {
+		static column_t Scalar( column_t a, column_t b )		{ return (column_t)( (unsigned int)a + (unsigned int)b ); }
+#ifdef ECS_SIMD_X86
+		ECS_TARGET_SSE41 static __m128i Sse( __m128i a, __m128i b )	{ return _mm_add_epi32( a, b ); }
+		ECS_TARGET_AVX2 static __m256i Avx( __m256i a, __m256i b )	{ return _mm256_add_epi32( a, b ); }
+#endif
+	};
+
+	struct OpSubtract {
+		static column_t Scalar( column_t a, column_t b )		{ return (column_t)( (unsigned int)a - (unsigned int)b ); }
+#ifdef ECS_SIMD_X86
+		ECS_TARGET_SSE41 static __m128i Sse( __m128i a, __m128i b )	{ return _mm_sub_epi32( a, b ); }
+		ECS_TARGET_AVX2 static __m256i Avx( __m256i a, __m256i b )	{ return _mm256_sub_epi32( a, b ); }
+#endif
+	};
+
+	struct OpMultiply {
+		static column_t Scalar( column_t a, column_t b )		{ return (column_t)( (unsigned int)a * (unsigned int)b ); }
+#ifdef ECS_SIMD_X86
+		ECS_TARGET_SSE41 static __m128i Sse( __m128i a, __m128i b )	{ return _mm_mullo_epi32( a, b ); }
+		ECS_TARGET_AVX2 static __m256i Avx( __m256i a, __m256i b )	{ return _mm256_mullo_epi32( a, b ); }
+#endif
+	};
+
+	struct OpMin {
+		static column_t Scalar( column_t a, column_t b )		{ return a < b ? a : b; }
+#ifdef ECS_SIMD_X86
+		ECS_TARGET_SSE41 static __m128i Sse( __m128i a, __m128i b )	{ return _mm_min_epi32( a, b ); }
+		ECS_TARGET_AVX2 static __m256i Avx( __m256i a, __m256i b )	{ return _mm256_min_epi32( a, b ); }
+#endif
+	};
+
+	struct OpMax {
+		static column_t Scalar( column_t a, column_t b )		{ return a > b ? a : b; }
+#ifdef ECS_SIMD_X86
+		ECS_TARGET_SSE41 static __m128i Sse( __m128i a, __m128i b )	{ return _mm_max_epi32( a, b ); }
+		ECS_TARGET_AVX2 static __m256i Avx( __m256i a, __m256i b )	{ return _mm256_max_epi32( a, b ); }
+#endif
+	};
+
+	template<typename Op> static void ApplyScalar( column_t* target, IN column_t* source, column_t value, size_t count, size_t i ) {
+		if( source ) {
+			for( ; i < count; i++ )
+				target[i] = Op::Scalar( target[i], source[i] );
+		}
+		else {
+			for( ; i < count; i++ )
+				target[i] = Op::Scalar( target[i], value );
+		}
+	}
+
+#ifdef ECS_SIMD_X86
+	template<typename Op> ECS_TARGET_SSE41 static void ApplySse( column_t* target, IN column_t* source, column_t value, size_t count ) {
+		size_t i = 0;
+		if( source ) {
+			for( ; i + 4 <= count; i += 4 ) {
+				__m128i a = _mm_loadu_si128( (const __m128i*)( target + i ) );
+				__m128i b = _mm_loadu_si128( (const __m128i*)( source + i ) );
+				_mm_storeu_si128( (__m128i*)( target + i ), Op::Sse( a, b ) );
+			}
+		}
+		else {
+			__m128i b = _mm_set1_epi32( value );
+			for( ; i + 4 <= count; i += 4 ) {
+				__m128i a = _mm_loadu_si128( (const __m128i*)( target + i ) );
+				_mm_storeu_si128( (__m128i*)( target + i ), Op::Sse( a, b ) );
+			}
+		}
+		ApplyScalar<Op>( target, source, value, count, i );
+	}
+
+	template<typename Op> ECS_TARGET_AVX2 static void ApplyAvx( column_t* target, IN column_t* source, column_t value, size_t count ) {
+		size_t i = 0;
+		if( source ) {
+			for( ; i + 8 <= count; i += 8 ) {
+				__m256i a = _mm256_loadu_si256( (const __m256i*)( target + i ) );
+				__m256i b = _mm256_loadu_si256( (const __m256i*)( source + i ) );
+				_mm256_storeu_si256( (__m256i*)( target + i ), Op::Avx( a, b ) );
+			}
+		}
+		else {
+			__m256i b = _mm256_set1_epi32( value );
+			for( ; i + 8 <= count; i += 8 ) {
+				__m256i a = _mm256_loadu_si256( (const __m256i*)( target + i ) );
+				_mm256_storeu_si256( (__m256i*)( target + i ), Op::Avx( a, b ) );
+			}
+		}
+		ApplyScalar<Op>( target, source, value, count, i );
+	}
+#endif
+
+	template<typename Op> static void Apply( column_t* target, IN column_t* source, column_t value, size_t count ) {
+		switch( Level() ) {
+#ifdef ECS_SIMD_X86
+		case SIMD_AVX2:		ApplyAvx<Op>( target, source, value, count ); break;
+		case SIMD_SSE41:	ApplySse<Op>( target, source, value, count ); break;
+#endif
+		default:			ApplyScalar<Op>( target, source, value, count, 0 ); break;
+		}
+	}
+
+	static SimdLevel& CurrentLevel() {
+		static SimdLevel level = Detect();
+		return level;
+	}
+public:
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Detects widest instruction set supported by processor and operating system. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	static SimdLevel Detect() {
+#if defined( ECS_SIMD_X86 ) && defined( __GNUC__ )
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports( "avx2" ) )
+			return SIMD_AVX2;
+		if( __builtin_cpu_supports( "sse4.1" ) )
+			return SIMD_SSE41;
+#elif defined( ECS_SIMD_X86 ) && defined( _MSC_VER )
+		int info[4];
+		__cpuid( info, 0 );
+		int ids = info[0];
+
+		__cpuid( info, 1 );
+		bool sse41		= ( info[2] & ( 1 << 19 ) ) != 0;
+		bool osxsave	= ( info[2] & ( 1 << 27 ) ) != 0;
+		bool avx		= ( info[2] & ( 1 << 28 ) ) != 0;
+
+		// AVX registers must be saved by operating system as well
+		if( ids >= 7 && osxsave && avx && ( _xgetbv( 0 ) & 6 ) == 6 ) {
+			__cpuidex( info, 7, 0 );
+			if( info[1] & ( 1 << 5 ) )
+				return SIMD_AVX2;
+		}
+		if( sse41 )
+			return SIMD_SSE41;
+#endif
+		return SIMD_SCALAR;
+	}
+
+	static SimdLevel Level() {
+		return CurrentLevel();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Limits kernels to given instruction set, e.g. for comparing timings. Levels above detected
+	/// 	one are ignored.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	static void SetLevel( IN SimdLevel level ) {
+		CurrentLevel() = std::min( level, Detect() );
+	}
+
+	static void Add( column_t* target, column_t value, size_t count )					{ Apply<OpAdd>( target, NULL, value, count ); }
+	static void Add( column_t* target, IN column_t* source, size_t count )			{ Apply<OpAdd>( target, source, 0, count ); }
+	static void Subtract( column_t* target, column_t value, size_t count )			{ Apply<OpSubtract>( target, NULL, value, count ); }
+	static void Subtract( column_t* target, IN column_t* source, size_t count )		{ Apply<OpSubtract>( target, source, 0, count ); }
+	static void Multiply( column_t* target, column_t value, size_t count )			{ Apply<OpMultiply>( target, NULL, value, count ); }
+	static void Multiply( column_t* target, IN column_t* source, size_t count )		{ Apply<OpMultiply>( target, source, 0, count ); }
+	static void Min( column_t* target, column_t value, size_t count )					{ Apply<OpMin>( target, NULL, value, count ); }
+	static void Min( column_t* target, IN column_t* source, size_t count )			{ Apply<OpMin>( target, source, 0, count ); }
+	static void Max( column_t* target, column_t value, size_t count )					{ Apply<OpMax>( target, NULL, value, count ); }
+	static void Max( column_t* target, IN column_t* source, size_t count )			{ Apply<OpMax>( target, source, 0, count ); }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Column family. Plain integer fields of one family stored as structure of arrays, one
+/// 	aligned column per field, all columns indexed by same dense row. Rows of enabled entities
+/// 	come first, rows of disabled ones are kept behind them, and rows are removed by moving
+/// 	other rows into their place, so columns stay contiguous. Bulk kernels update whole columns
+/// 	of enabled rows, so disabled entities are left untouched:
+/// 		enum { HEALTH, MAX_HEALTH, REGENERATION };
+/// 		ColumnFamily* stats = RegisterStorage( new ColumnFamily( CFID_STATS, 3 ) );
+/// 		CreateRow( entityId, CFID_STATS );
+/// 		stats->AddColumn( HEALTH, REGENERATION );
+/// 		stats->MinColumn( HEALTH, MAX_HEALTH );
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ColumnFamily : public FamilyStorage {
+	std::vector< column_t* >	mColumns;
+	std::vector< column_t >		mDefaults;
+	size_t						mCapacity;
+	FamilyRows					mRows;
+
+	static column_t* AllocateColumn( size_t capacity ) {
+		void* memory = NULL;
+#ifdef _MSC_VER
+		memory = _aligned_malloc( capacity * sizeof( column_t ), COLUMN_ALIGNMENT );
+#else
+		if( posix_memalign( &memory, COLUMN_ALIGNMENT, capacity * sizeof( column_t ) ) != 0 )
+			memory = NULL;
+#endif
+		if( memory == NULL )
+			throw std::bad_alloc();
+		return (column_t*)memory;
+	}
+
+	static void FreeColumn( column_t* column ) {
+#ifdef _MSC_VER
+		_aligned_free( column );
+#else
+		free( column );
+#endif
+	}
+
+	// capacity is kept multiple of register width, so kernels run mostly on full registers
+	void Grow( size_t rows ) {
+		if( rows <= mCapacity )
+			return;
+
+		size_t capacity = std::max( rows, mCapacity * 2 );
+		capacity = ( capacity + 7 ) & ~(size_t)7;
+
+		for( size_t i = 0; i < mColumns.size(); i++ ) {
+			column_t* column = AllocateColumn( capacity );
+			if( mColumns[i] ) {
+				memcpy( column, mColumns[i], mRows.Size() * sizeof( column_t ) );
+				FreeColumn( mColumns[i] );
+			}
+			mColumns[i] = column;
+		}
+		mCapacity = capacity;
+	}
+
+	void SwapRows( IN size_t a, IN size_t b ) {
+		for( size_t i = 0; i < mColumns.size(); i++ )
+			std::swap( mColumns[i][a], mColumns[i][b] );
+	}
+
+	// columns are owned by family
+	ColumnFamily( IN ColumnFamily& );
+	ColumnFamily& operator=( IN ColumnFamily& );
+public:
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Constructor. </summary>
+	/// <param name="familyId">	Identifier for the family. </param>
+	/// <param name="columns"> 	Number of integer fields of family. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ColumnFamily( IN family_t familyId, IN size_t columns ) : FamilyStorage( familyId ), mColumns( columns, (column_t*)NULL ), mDefaults( columns, 0 ), mCapacity( 0 ) {}
+
+	virtual ~ColumnFamily() {
+		for( size_t i = 0; i < mColumns.size(); i++ )
+			FreeColumn( mColumns[i] );
+		mColumns.clear();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Sets value given field gets in newly inserted rows. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void SetDefault( IN size_t column, IN column_t value ) {
+		mDefaults[ column ] = value;
+	}
+
+	virtual bool Insert( IN entity_t entityId ) {
+		if( Contains( entityId ) )
+			return false;
+
+		Grow( mRows.Size() + 1 );
+
+		size_t row = mRows.Size();
+		for( size_t i = 0; i < mColumns.size(); i++ )
+			mColumns[i][ row ] = mDefaults[i];
+
+		mRows.Insert( entityId, [this]( size_t a, size_t b ) { SwapRows( a, b ); } );
+		return true;
+	}
+
+	virtual bool Remove( IN entity_t entityId ) {
+		if( !Contains( entityId ) )
+			return false;
+
+		mRows.Remove( entityId, [this]( size_t a, size_t b ) { SwapRows( a, b ); } );
+		return true;
+	}
+
+	virtual void SetEnabled( IN entity_t entityId, IN bool enabled ) {
+		mRows.SetEnabled( entityId, enabled, [this]( size_t a, size_t b ) { SwapRows( a, b ); } );
+	}
+
+	virtual bool Contains( IN entity_t entityId ) const {
+		return mRows.Contains( entityId );
+	}
+
+	virtual size_t Size() const {
+		return mRows.Size();
+	}
+
+	virtual void Reserve( IN size_t rows ) {
+		Grow( rows );
+		mRows.Reserve( rows );
+	}
+
+	virtual void Clear() {
+		mRows.Clear();
+	}
+
+	virtual size_t MemoryBytes() const {
+		return mColumns.size() * ( mCapacity * sizeof( column_t ) + sizeof( column_t* ) + sizeof( column_t ) ) + mRows.MemoryBytes();
+	}
+
+	virtual const entity_array& Entities() const {
+		return mRows.Entities();
+	}
+
+	virtual bool WriteRow( IN entity_t entityId, std::ostream& stream ) const {
+		size_t row = mRows.Row( entityId );
+		for( size_t i = 0; i < mColumns.size(); i++ )
+			stream.write( reinterpret_cast<const char*>( &mColumns[i][ row ] ), sizeof( column_t ) );
+		return !stream.fail();
+	}
+
+	virtual bool ReadRow( IN entity_t entityId, std::istream& stream ) {
+		size_t row = mRows.Row( entityId );
+		for( size_t i = 0; i < mColumns.size(); i++ )
+			stream.read( reinterpret_cast<char*>( &mColumns[i][ row ] ), sizeof( column_t ) );
+		return !stream.fail();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Gets field of given entity. Entity must have row in this family. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	column_t& Get( IN entity_t entityId, IN size_t column ) {
+		return mColumns[ column ][ mRows.Row( entityId ) ];
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Gets whole column, one value per row, entity of each row is given by Entities. First
+	/// 	EnabledSize rows belong to enabled entities.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	column_t* Column( IN size_t column )			{ return mColumns[ column ]; }
+	size_t EnabledSize() const						{ return mRows.EnabledSize(); }
+	size_t Columns() const							{ return mColumns.size(); }
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Bulk transforms of enabled rows. Target column is updated with value, or with source column (Column variants). </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Add( IN size_t target, IN column_t value )				{ ColumnKernels::Add( mColumns[ target ], value, mRows.EnabledSize() ); }
+	void AddColumn( IN size_t target, IN size_t source )		{ ColumnKernels::Add( mColumns[ target ], mColumns[ source ], mRows.EnabledSize() ); }
+	void Subtract( IN size_t target, IN column_t value )		{ ColumnKernels::Subtract( mColumns[ target ], value, mRows.EnabledSize() ); }
+	void SubtractColumn( IN size_t target, IN size_t source )	{ ColumnKernels::Subtract( mColumns[ target ], mColumns[ source ], mRows.EnabledSize() ); }
+	void Multiply( IN size_t target, IN column_t value )		{ ColumnKernels::Multiply( mColumns[ target ], value, mRows.EnabledSize() ); }
+	void MultiplyColumn( IN size_t target, IN size_t source )	{ ColumnKernels::Multiply( mColumns[ target ], mColumns[ source ], mRows.EnabledSize() ); }
+	void Min( IN size_t target, IN column_t value )				{ ColumnKernels::Min( mColumns[ target ], value, mRows.EnabledSize() ); }
+	void MinColumn( IN size_t target, IN size_t source )		{ ColumnKernels::Min( mColumns[ target ], mColumns[ source ], mRows.EnabledSize() ); }
+	void Max( IN size_t target, IN column_t value )				{ ColumnKernels::Max( mColumns[ target ], value, mRows.EnabledSize() ); }
+	void MaxColumn( IN size_t target, IN size_t source )		{ ColumnKernels::Max( mColumns[ target ], mColumns[ source ], mRows.EnabledSize() ); }
+};
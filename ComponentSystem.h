@@ -7,12 +7,23 @@
 #include <vector>
 #include <memory>
 #include <typeinfo>
+#include <mutex>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
 
 #define CFID_UNKNOWN 0
 #undef IN
 #define IN const
 #define OUT
 
+#include "Trace.h"
+
 typedef unsigned int	family_t;
 typedef unsigned int	entity_t;
 typedef unsigned int	cid_t;
@@ -26,7 +37,7 @@ struct Component {
 
 #if defined( WIN32 )
 typedef std::tr1::shared_ptr<Component> ComponentPtr;
-#elif defined(__APPLE__) && defined(__MACH__)
+#else
 typedef std::shared_ptr<Component> ComponentPtr;
 #endif
 
@@ -45,117 +56,496 @@ template<typename Type> inline Type safe_cast( ComponentPtr ptr ) {
 }
 inline bool type_of( ComponentPtr ptr, family_t familyId ) { return ptr->mFamilyId == familyId; }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Process wide heap allocation counter. Counter is only incremented when global operator new
+/// 	is replaced by placing ECS_DEFINE_ALLOCATION_COUNTER in exactly one translation unit. Used
+/// 	for verifying that create/delete within reserved capacity performs no heap allocation:
+/// 		size_t before = AllocationCounter::Count();
+/// 		...
+/// 		assert( AllocationCounter::Count() == before );
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined( _MSC_VER )
+#define ECS_NOINLINE	__declspec( noinline )
+#else
+#define ECS_NOINLINE	__attribute__(( noinline ))
+#endif
+
+struct AllocationCounter {
+	static std::atomic<size_t>& Counter() {
+		static std::atomic<size_t> counter( 0 );
+		return counter;
+	}
+	static size_t Count()		{ return Counter().load(); }
+	static void Increment()		{ Counter().fetch_add( 1, std::memory_order_relaxed ); }
+
+	// not inlined into replaced operators, so compilers don't report malloc/free as mismatched with new/delete
+	static ECS_NOINLINE void* Allocate( std::size_t size ) {
+		Increment();
+		if( void* ptr = std::malloc( size ? size : 1 ) )
+			return ptr;
+		throw std::bad_alloc();
+	}
+	static ECS_NOINLINE void Free( void* ptr ) {
+		std::free( ptr );
+	}
+};
+
+#define ECS_DEFINE_ALLOCATION_COUNTER \
+	void* operator new( std::size_t size ) { return AllocationCounter::Allocate( size ); } \
+	void* operator new[]( std::size_t size ) { return AllocationCounter::Allocate( size ); } \
+	void operator delete( void* ptr ) noexcept { AllocationCounter::Free( ptr ); } \
+	void operator delete[]( void* ptr ) noexcept { AllocationCounter::Free( ptr ); } \
+	void operator delete( void* ptr, std::size_t ) noexcept { AllocationCounter::Free( ptr ); } \
+	void operator delete[]( void* ptr, std::size_t ) noexcept { AllocationCounter::Free( ptr ); }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Component memory arena. Keeps released blocks in free lists by size class, so component
+/// 	memory is reused instead of returned to heap. Component and its reference count are
+/// 	allocated in single block. Arena is kept alive by every component allocated from it.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ComponentArena {
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	static const size_t GRANULARITY = 16;
+
+	std::vector< FreeBlock* >	mFreeLists;
+	std::mutex					mMutex;
+	size_t						mHeapAllocations;
+	size_t						mBytesInUse;
+	size_t						mBytesFree;
+
+	static size_t SizeClass( IN size_t bytes ) {
+		return ( bytes + GRANULARITY - 1 ) / GRANULARITY;
+	}
+public:
+	ComponentArena() : mHeapAllocations( 0 ), mBytesInUse( 0 ), mBytesFree( 0 ) {}
+	~ComponentArena() {
+		for( size_t i = 0; i < mFreeLists.size(); i++ ) {
+			while( mFreeLists[i] ) {
+				FreeBlock* block = mFreeLists[i];
+				mFreeLists[i] = block->next;
+				::operator delete( block );
+			}
+		}
+	}
+
+	void* Allocate( IN size_t bytes ) {
+		size_t sizeClass = SizeClass( bytes );
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		mBytesInUse += sizeClass * GRANULARITY;
+		if( sizeClass < mFreeLists.size() && mFreeLists[ sizeClass ] ) {
+			FreeBlock* block = mFreeLists[ sizeClass ];
+			mFreeLists[ sizeClass ] = block->next;
+			mBytesFree -= sizeClass * GRANULARITY;
+			return block;
+		}
+
+		mHeapAllocations++;
+		return ::operator new( sizeClass * GRANULARITY );
+	}
+
+	void Deallocate( void* ptr, IN size_t bytes ) {
+		size_t sizeClass = SizeClass( bytes );
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		if( sizeClass >= mFreeLists.size() )
+			mFreeLists.resize( sizeClass + 1, NULL );
+
+		FreeBlock* block = static_cast<FreeBlock*>( ptr );
+		block->next = mFreeLists[ sizeClass ];
+		mFreeLists[ sizeClass ] = block;
+		mBytesInUse -= sizeClass * GRANULARITY;
+		mBytesFree += sizeClass * GRANULARITY;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Adds given number of heap allocated blocks to free list of size class. </summary>
+	///
+	/// <param name="bytes">	Size of one block. </param>
+	/// <param name="count">	Number of blocks. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Reserve( IN size_t bytes, IN size_t count ) {
+		size_t sizeClass = SizeClass( bytes );
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		if( sizeClass >= mFreeLists.size() )
+			mFreeLists.resize( sizeClass + 1, NULL );
+
+		for( size_t i = 0; i < count; i++ ) {
+			FreeBlock* block = static_cast<FreeBlock*>( ::operator new( sizeClass * GRANULARITY ) );
+			block->next = mFreeLists[ sizeClass ];
+			mFreeLists[ sizeClass ] = block;
+		}
+		mHeapAllocations += count;
+		mBytesFree += count * sizeClass * GRANULARITY;
+	}
+
+	size_t HeapAllocations() const	{ return mHeapAllocations; }
+	size_t BytesInUse() const		{ return mBytesInUse; }
+	size_t BytesFree() const		{ return mBytesFree; }
+};
+
+typedef std::shared_ptr< ComponentArena > ArenaPtr;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Standard allocator allocating from component arena. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename Type> class ArenaAllocator {
+public:
+	typedef Type value_type;
+
+	ArenaPtr mArena;
+
+	ArenaAllocator( IN ArenaPtr& arena ) : mArena( arena ) {}
+	template<typename Other> ArenaAllocator( IN ArenaAllocator<Other>& other ) : mArena( other.mArena ) {}
+
+	Type* allocate( size_t count )				{ return static_cast<Type*>( mArena->Allocate( count * sizeof( Type ) ) ); }
+	void deallocate( Type* ptr, size_t count )	{ mArena->Deallocate( ptr, count * sizeof( Type ) ); }
+
+	template<typename Other> bool operator==( IN ArenaAllocator<Other>& other ) const { return mArena == other.mArena; }
+	template<typename Other> bool operator!=( IN ArenaAllocator<Other>& other ) const { return mArena != other.mArena; }
+};
+
 typedef std::vector< entity_t >	entity_array;
 typedef std::list< entity_t >	entity_list;
 typedef std::list< entity_t >::iterator	entity_list_iterator;
 
-class EntitySystem {
-	entity_list		mErasedIds;
-	entity_array	mEntities;
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Set of bits indexed by identifier. Grows when bit above its size is set. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BitSet {
+	std::vector< unsigned int >	mWords;
+
+	static unsigned int LowestBit( IN unsigned int word ) {
+#if defined( _MSC_VER )
+		unsigned long bit;
+		_BitScanForward( &bit, word );
+		return bit;
+#else
+		return __builtin_ctz( word );
+#endif
+	}
 public:
-	EntitySystem()
-	{
-		// 0 is undefined value, treated for handling errors
-		mEntities.push_back(0);
+	void Set( IN unsigned int bit ) {
+		if( ( bit >> 5 ) >= mWords.size() )
+			mWords.resize( ( bit >> 5 ) + 1, 0 );
+		mWords[ bit >> 5 ] |= 1u << ( bit & 31 );
 	}
-	~EntitySystem() {
-		mEntities.clear();
-		mErasedIds.clear();
+
+	void Reset( IN unsigned int bit ) {
+		if( ( bit >> 5 ) < mWords.size() )
+			mWords[ bit >> 5 ] &= ~( 1u << ( bit & 31 ) );
 	}
 
-	entity_t	CreateNewEntity() {
-		if( mErasedIds.empty() )
-		{
-			mEntities.push_back( mEntities.size() );
-			return mEntities.size()-1;
+	bool Test( IN unsigned int bit ) const {
+		return ( bit >> 5 ) < mWords.size() && ( mWords[ bit >> 5 ] & ( 1u << ( bit & 31 ) ) ) != 0;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Calls function for every set bit, in increasing order. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Function> void ForEach( Function function ) const {
+		for( size_t i = 0; i < mWords.size(); i++ ) {
+			for( unsigned int word = mWords[i]; word; word &= word - 1 )
+				function( (unsigned int)( i << 5 ) + LowestBit( word ) );
 		}
+	}
+
+	void Resize( IN unsigned int bits )		{ mWords.resize( ( bits + 31 ) >> 5, 0 ); }
+	void Reserve( IN unsigned int bits )	{ mWords.reserve( ( bits + 31 ) >> 5 ); }
+	void Clear()							{ mWords.clear(); }
+	size_t MemoryBytes() const				{ return mWords.capacity() * sizeof( unsigned int ); }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Pool of identifiers. Keeps occupancy bitmap and intrusive, doubly linked free list stored in
+/// 	arrays indexed by identifier, so acquiring, releasing, reserving specific identifier and
+/// 	trimming free identifiers from the end are all O(1) amortized. Free identifiers are reused
+/// 	in order they were released. Identifier 0 is always reserved, and is used as list terminator.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class IdPool {
+	struct Link {
+		unsigned int prev;
+		unsigned int next;
+	};
+
+	std::vector< Link >			mLinks;
+	BitSet						mUsed;
+	unsigned int				mHead;
+	unsigned int				mTail;
+	unsigned int				mFreeCount;
+
+	void SetUsed( IN unsigned int id, IN bool used ) {
+		if( used )
+			mUsed.Set( id );
 		else
-		{
-			// yes. get old erased id then replace it with a new component
-			entity_t erasedId = mErasedIds.front();
-			mErasedIds.pop_front();
-			mEntities[ erasedId ] = erasedId;
-			return erasedId;
+			mUsed.Reset( id );
+	}
+
+	void PushFree( IN unsigned int id ) {
+		mLinks[ id ].prev = mTail;
+		mLinks[ id ].next = 0;
+		if( mTail )
+			mLinks[ mTail ].next = id;
+		else
+			mHead = id;
+		mTail = id;
+		mFreeCount++;
+	}
+
+	void Unlink( IN unsigned int id ) {
+		if( mLinks[ id ].prev )
+			mLinks[ mLinks[ id ].prev ].next = mLinks[ id ].next;
+		else
+			mHead = mLinks[ id ].next;
+
+		if( mLinks[ id ].next )
+			mLinks[ mLinks[ id ].next ].prev = mLinks[ id ].prev;
+		else
+			mTail = mLinks[ id ].prev;
+		mFreeCount--;
+	}
+
+	// grows pool to given size, new identifiers are free
+	void Grow( IN unsigned int size ) {
+		unsigned int first = Size();
+		if( size <= first )
+			return;
+
+		mLinks.resize( size );
+		mUsed.Resize( size );
+
+		// link whole gap in one pass, then attach it to end of free list
+		for( unsigned int i = first; i < size; i++ ) {
+			mLinks[ i ].prev = i - 1;
+			mLinks[ i ].next = i + 1;
 		}
+		mLinks[ first ].prev = mTail;
+		mLinks[ size-1 ].next = 0;
+		if( mTail )
+			mLinks[ mTail ].next = first;
+		else
+			mHead = first;
+		mTail = size - 1;
+		mFreeCount += size - first;
+	}
+public:
+	IdPool() {
+		Clear();
 	}
-	/// <summary>	Creates new entity under specific identifier. Gasps will be reserved and erased.
-	/// 			In case entity ID is already reserved, function will fail. </summary>
-	entity_t	CreateNewEntityUnderId( entity_t entityId ) {
-		if( entityId > 0 )
-		{
-			if( Exist( entityId ) )
-				return 0;
 
-			// check under erased ID-s
-			if( mErasedIds.empty() == false )
-			{
-				// look for entity ID under erased ID-s
-				for( entity_list_iterator erasedId = mErasedIds.begin(); erasedId != mErasedIds.end(); erasedId++ ) {
-					if( *erasedId == entityId ) {
-						// we have found it
-						mErasedIds.erase( erasedId );
-						mEntities[ entityId ] = entityId;
-
-						return entityId;
-					}
-				}
-			}
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Acquires first free identifier, or new one at the end if there is none. </summary>
+	/// <returns>	Acquired identifier. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-			// we don't have any erased entities or its not found under erased ones
-			// entity ID will be next in row?
-			if( entityId == mEntities.size() )	{
-				// yes. just create and return normally.
-				mEntities.push_back( mEntities.size() );
-				return mEntities.size()-1;
-			}
+	unsigned int Acquire() {
+		if( mHead == 0 )
+			return Append();
 
-			// on this point it can't be lesser than size (either its in erased ID's or its took )
-			if( entityId < mEntities.size() )
-				return 0;
+		unsigned int id = mHead;
+		Unlink( id );
+		SetUsed( id, true );
+		return id;
+	}
 
-			for( size_t i = mEntities.size(); i<entityId;  i++ ) {
-				mEntities.push_back( i );
-				mErasedIds.push_back( i );
-			}
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Acquires new identifier at the end, regardless of free identifiers. </summary>
+	/// <returns>	Acquired identifier. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-			mEntities.push_back( entityId );
-			return entityId;
+	unsigned int Append() {
+		unsigned int id = Size();
+		mLinks.push_back( Link() );
+		SetUsed( id, true );
+		return id;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Acquires specific identifier. Identifiers between end of pool and given one are added as
+	/// 	free ones.
+	/// </summary>
+	/// <param name="id">	Identifier to acquire. </param>
+	/// <returns>	true if it succeeds, false if identifier is already used. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool AcquireId( IN unsigned int id ) {
+		if( id >= Size() )
+			Grow( id + 1 );
+		else if( IsUsed( id ) )
+			return false;
+
+		Unlink( id );
+		SetUsed( id, true );
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Releases used identifier. </summary>
+	/// <param name="id">	Identifier to release. </param>
+	/// <returns>	true if it succeeds, false if identifier was not used. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool Release( IN unsigned int id ) {
+		if( id == 0 || !IsUsed( id ) )
+			return false;
+
+		SetUsed( id, false );
+		PushFree( id );
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Removes free identifiers from the end of pool. </summary>
+	/// <returns>	New size of pool. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	unsigned int Trim() {
+		while( Size() > 1 && !IsUsed( Size()-1 ) ) {
+			Unlink( Size()-1 );
+			mLinks.pop_back();
 		}
+		mUsed.Resize( Size() );
+		return Size();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Resizes pool. New identifiers are free, identifiers above new size are dropped whether they
+	/// 	are used or not.
+	/// </summary>
+	/// <param name="size">	New size of pool. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Resize( unsigned int size ) {
+		if( size < 1 )
+			size = 1;
+
+		while( Size() > size ) {
+			if( IsUsed( Size()-1 ) )
+				SetUsed( Size()-1, false );
+			else
+				Unlink( Size()-1 );
+			mLinks.pop_back();
+		}
+		mUsed.Resize( Size() );
+		Grow( size );
+	}
+
+	void Reserve( IN unsigned int size ) {
+		mLinks.reserve( size );
+		mUsed.Reserve( size );
+	}
+
+	size_t MemoryBytes() const {
+		return mLinks.capacity() * sizeof( Link ) + mUsed.MemoryBytes();
+	}
+
+	bool IsUsed( IN unsigned int id ) const {
+		return id < Size() && mUsed.Test( id );
+	}
+
+	unsigned int Size() const		{ return (unsigned int)mLinks.size(); }
+	unsigned int FreeCount() const	{ return mFreeCount; }
+	bool Empty() const				{ return mFreeCount == 0; }
+
+	void Clear() {
+		mLinks.clear();
+		mUsed.Clear();
+		mHead = mTail = mFreeCount = 0;
+
+		// 0 is undefined value, treated for handling errors
+		Append();
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Hierarchy links of one entity. Children of each parent form doubly linked sibling list,
+/// 	0 terminates every link.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct EntityLinks {
+	EntityLinks() : parent( 0 ), firstChild( 0 ), lastChild( 0 ), nextSibling( 0 ), prevSibling( 0 ) {}
+	entity_t	parent;
+	entity_t	firstChild;
+	entity_t	lastChild;
+	entity_t	nextSibling;
+	entity_t	prevSibling;
+};
+
+class EntitySystem {
+	IdPool		mIds;
+
+	/// <summary>	Hierarchy links indexed by entity, grown on first link. </summary>
+	std::vector< EntityLinks >	mLinks;
+
+	void Unlink( IN entity_t entityId ) {
+		EntityLinks& links = mLinks[ entityId ];
+		if( links.parent == 0 )
+			return;
+
+		EntityLinks& parent = mLinks[ links.parent ];
+		if( links.prevSibling )	mLinks[ links.prevSibling ].nextSibling = links.nextSibling;
+		else					parent.firstChild = links.nextSibling;
+		if( links.nextSibling )	mLinks[ links.nextSibling ].prevSibling = links.prevSibling;
+		else					parent.lastChild = links.prevSibling;
+
+		links.parent = links.nextSibling = links.prevSibling = 0;
+	}
+public:
+	EntitySystem() {}
+	~EntitySystem() {
+		mIds.Clear();
+	}
+
+	entity_t	CreateNewEntity() {
+		return mIds.Acquire();
+	}
+	/// <summary>	Creates new entity under specific identifier. Gasps will be reserved and erased.
+	/// 			In case entity ID is already reserved, function will fail. </summary>
+	entity_t	CreateNewEntityUnderId( entity_t entityId ) {
+		if( entityId > 0 && mIds.AcquireId( entityId ) )
+			return entityId;
 
 		return 0;
 	}
 	entity_t	size()
 	{
-		return mEntities.size();
+		return mIds.Size();
 	}
 
 	bool Delete( entity_t entityId )
 	{
-		if( Exist( entityId ) )
+		if( mIds.Release( entityId ) )
 		{
-			if( entityId != mEntities.back() )
-				mErasedIds.push_back( entityId );
-			else
-				mEntities.pop_back();
+			// detach from parent, children become roots
+			if( entityId < mLinks.size() ) {
+				Unlink( entityId );
+				while( mLinks[ entityId ].firstChild )
+					Unlink( mLinks[ entityId ].firstChild );
+			}
 
 			// check if last items are erased, if so, reduce array size
-			while( mEntities.empty() == false ) {
-				size_t lastId = mEntities.back();
-
-				bool erased = false;
-				// also check if there is such a UID in erased ID's list
-				for( entity_list::iterator it = mErasedIds.begin(); it!=mErasedIds.end(); ++it ) {
-					if( *it == lastId )
-					{
-						mEntities.pop_back();
-						mErasedIds.erase( it );
-						erased = true;
-						break;
-					}
-				}
-				if( !erased )
-					return true;
-			}
+			mIds.Trim();
 			return true;
 		}
 
@@ -163,27 +553,469 @@ public:
 	}
 
 	bool Exist( entity_t parentId ) {
-		// if size is ok
-		if( parentId < mEntities.size() )
-		{
-			// and if id is not under erased ID-s
-			for( entity_list_iterator i = mErasedIds.begin(); i != mErasedIds.end(); i++ )
-				if( *i == parentId )
-					return false;
+		return mIds.IsUsed( parentId );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Sets parent of entity. Entity is appended as last child of parent, after being detached
+	/// 	from its previous parent.
+	/// </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="parentId">	Identifier for the parent, 0 to detach entity. </param>
+	///
+	/// <returns>	false if either entity doesn't exist, or parent is entity itself or its descendant. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-			// then exists
+	bool SetParent( entity_t entityId, entity_t parentId ) {
+		if( !Exist( entityId ) || ( parentId && !Exist( parentId ) ) )
+			return false;
+
+		entity_t highest = entityId > parentId ? entityId : parentId;
+		if( highest >= mLinks.size() )
+			mLinks.resize( highest + 1 );
+
+		// refuse cycles
+		for( entity_t ancestor = parentId; ancestor; ancestor = mLinks[ ancestor ].parent )
+			if( ancestor == entityId )
+				return false;
+
+		Unlink( entityId );
+		if( parentId == 0 )
 			return true;
-		}
 
-		return false;
+		EntityLinks& parent = mLinks[ parentId ];
+		EntityLinks& links	= mLinks[ entityId ];
+		links.parent		= parentId;
+		links.prevSibling	= parent.lastChild;
+		if( parent.lastChild )	mLinks[ parent.lastChild ].nextSibling = entityId;
+		else					parent.firstChild = entityId;
+		parent.lastChild	= entityId;
+		return true;
+	}
+
+	entity_t GetParent( entity_t entityId ) const		{ return entityId < mLinks.size() ? mLinks[ entityId ].parent : 0; }
+	entity_t FirstChild( entity_t entityId ) const		{ return entityId < mLinks.size() ? mLinks[ entityId ].firstChild : 0; }
+	entity_t NextSibling( entity_t entityId ) const		{ return entityId < mLinks.size() ? mLinks[ entityId ].nextSibling : 0; }
+	bool HasChildren( entity_t entityId ) const			{ return FirstChild( entityId ) != 0; }
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Gets direct children of entity, in order they were attached. </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="children">	[out] Children. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void GetChildren( entity_t entityId, OUT entity_array& children ) const {
+		children.clear();
+		for( entity_t child = FirstChild( entityId ); child; child = mLinks[ child ].nextSibling )
+			children.push_back( child );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Gets all descendants of entity in breadth first order, so each parent comes before its
+	/// 	children. Suitable for propagating values from parents down to children.
+	/// </summary>
+	///
+	/// <param name="entityId">	  	Identifier for the entity. </param>
+	/// <param name="descendants">	[out] Descendants. </param>
+	/// <param name="includeRoot">	true to put entity itself first. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void GetDescendants( entity_t entityId, OUT entity_array& descendants, bool includeRoot = false ) const {
+		descendants.clear();
+		if( includeRoot )
+			descendants.push_back( entityId );
+
+		// output doubles as queue
+		for( entity_t child = FirstChild( entityId ); child; child = mLinks[ child ].nextSibling )
+			descendants.push_back( child );
+
+		for( size_t i = includeRoot ? 1 : 0; i < descendants.size(); i++ )
+			for( entity_t child = FirstChild( descendants[i] ); child; child = mLinks[ child ].nextSibling )
+				descendants.push_back( child );
+	}
+
+	// entity ids start at 1, slot 0 is kept
+	void Reserve( entity_t entities ) {
+		mIds.Reserve( entities + 1 );
+		mLinks.reserve( entities + 1 );
+	}
+	size_t MemoryBytes() const {
+		return mIds.MemoryBytes() + mLinks.capacity() * sizeof( EntityLinks );
 	}
 	void Clear(){
-		mErasedIds.clear();
+		mIds.Clear();
+		mLinks.clear();
+	}
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Persistent query registered with component system. Holds set of entities which have at least
+/// 	one component of every queried family. Set is maintained incrementally when components are
+/// 	created, replaced and deleted, so iterating query costs only size of its result.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ComponentQuery {
+	friend class ComponentSystem;
+
+	std::vector< family_t >		mFamilies;
+	entity_array				mEntities;
+	/// <summary>	Position of entity in entity array plus one, 0 if entity is not matched. </summary>
+	std::vector< unsigned int >	mIndex;
+
+	ComponentQuery( IN std::vector< family_t >& families ) : mFamilies( families ) {}
+
+	void Insert( IN entity_t entityId ) {
+		if( entityId >= mIndex.size() )
+			mIndex.resize( entityId + 1, 0 );
+
+		mEntities.push_back( entityId );
+		mIndex[ entityId ] = (unsigned int)mEntities.size();
+	}
+
+	void Remove( IN entity_t entityId ) {
+		// move last entity into place of removed one
+		unsigned int position = mIndex[ entityId ] - 1;
+		entity_t lastId = mEntities.back();
+		mEntities[ position ] = lastId;
+		mIndex[ lastId ] = position + 1;
+		mEntities.pop_back();
+		mIndex[ entityId ] = 0;
+	}
+
+	void Clear() {
 		mEntities.clear();
-		mEntities.push_back(0);
+		mIndex.clear();
+	}
+
+	void Reserve( IN entity_t entities ) {
+		mEntities.reserve( entities );
+		if( mIndex.size() < entities + 1 )
+			mIndex.resize( entities + 1, 0 );
+	}
+public:
+	size_t MemoryBytes() const {
+		return	sizeof( ComponentQuery ) +
+				mFamilies.capacity() * sizeof( family_t ) +
+				mEntities.capacity() * sizeof( entity_t ) +
+				mIndex.capacity() * sizeof( unsigned int );
+	}
+
+	bool Contains( IN entity_t entityId ) const {
+		return entityId < mIndex.size() && mIndex[ entityId ] != 0;
+	}
+
+	/// <summary>	Position of entity in entity array. Entity must be matched. </summary>
+	size_t Position( IN entity_t entityId ) const	{ return mIndex[ entityId ] - 1; }
+	const entity_array& Entities() const			{ return mEntities; }
+	const std::vector< family_t >& Families() const	{ return mFamilies; }
+	size_t Size() const								{ return mEntities.size(); }
+	bool Empty() const								{ return mEntities.empty(); }
+
+	entity_array::const_iterator begin() const		{ return mEntities.begin(); }
+	entity_array::const_iterator end() const		{ return mEntities.end(); }
+};
+
+typedef std::vector< ComponentQuery* >				query_vector;
+typedef std::map< family_t, query_vector >			query_map;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Tag family. Marker without any data, stored as one bit per entity instead of allocated
+/// 	component.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct TagFamily {
+	TagFamily() : count( 0 ) {}
+	BitSet	entities;
+	size_t	count;
+};
+
+typedef std::map< family_t, TagFamily >				tag_map;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Memory used by components of one family. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct FamilyMemory {
+	family_t	familyId;
+	size_t		components;
+	/// <summary>	Size of one component, 0 if unknown (attached components). </summary>
+	size_t		componentSize;
+	/// <summary>	Bytes of component objects. </summary>
+	size_t		payloadBytes;
+	/// <summary>
+	/// 	Reference counts, allocation rounding and pointers held by component system. Pointers are
+	/// 	reported under index structures as well, and are not counted twice in total.
+	/// </summary>
+	size_t		overheadBytes;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Memory report of component system. Family payload is computed from component sizes, index
+/// 	structures from container capacities, node based containers with estimated node overhead.
+/// 	Arena numbers are measured by component allocator.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct MemoryUsage {
+	std::vector< FamilyMemory >	families;
+
+	size_t	componentArrayBytes;
+	size_t	entityRowBytes;
+	size_t	familyMapBytes;
+	size_t	componentIdBytes;
+	size_t	entityIdBytes;
+	size_t	queryBytes;
+	size_t	tagBytes;
+	size_t	storageBytes;
+
+	/// <summary>	Bytes of component array slots held by erased unique ids. </summary>
+	size_t	erasedBytes;
+	/// <summary>	Bytes of reserved, unused capacity of index containers. </summary>
+	size_t	slackBytes;
+
+	/// <summary>	Bytes of components allocated from arena, and bytes cached in its free lists. </summary>
+	size_t	arenaInUseBytes;
+	size_t	arenaFreeBytes;
+
+	MemoryUsage() :
+		componentArrayBytes( 0 ), entityRowBytes( 0 ), familyMapBytes( 0 ), componentIdBytes( 0 ),
+		entityIdBytes( 0 ), queryBytes( 0 ), tagBytes( 0 ), storageBytes( 0 ), erasedBytes( 0 ), slackBytes( 0 ), arenaInUseBytes( 0 ), arenaFreeBytes( 0 ) {}
+
+	size_t IndexBytes() const {
+		return componentArrayBytes + entityRowBytes + familyMapBytes + componentIdBytes + entityIdBytes + queryBytes + tagBytes + storageBytes;
+	}
+
+	size_t PayloadBytes() const {
+		size_t bytes = 0;
+		for( size_t i = 0; i < families.size(); i++ )
+			bytes += families[i].payloadBytes;
+		return bytes;
+	}
+
+	size_t OverheadBytes() const {
+		size_t bytes = 0;
+		for( size_t i = 0; i < families.size(); i++ )
+			bytes += families[i].overheadBytes;
+		return bytes;
+	}
+
+	size_t Total() const {
+		return IndexBytes() + arenaInUseBytes + arenaFreeBytes;
+	}
+
+	void Dump( std::ostream& stream ) const {
+		stream << "--- Memory report (bytes) ---" << std::endl;
+		for( size_t i = 0; i < families.size(); i++ ) {
+			stream
+				<< " FID(" << families[i].familyId << ") "
+				<< " count(" << families[i].components << ") "
+				<< " payload(" << families[i].payloadBytes << ") "
+				<< " overhead(" << families[i].overheadBytes << ") "
+				<< std::endl;
+		}
+		stream
+			<< " component array(" << componentArrayBytes << ") " << std::endl
+			<< " entity rows(" << entityRowBytes << ") " << std::endl
+			<< " family map(" << familyMapBytes << ") " << std::endl
+			<< " component ids(" << componentIdBytes << ") " << std::endl
+			<< " entity ids(" << entityIdBytes << ") " << std::endl
+			<< " queries(" << queryBytes << ") " << std::endl
+			<< " tags(" << tagBytes << ") " << std::endl
+			<< " storages(" << storageBytes << ") " << std::endl
+			<< " erased(" << erasedBytes << ") " << std::endl
+			<< " slack(" << slackBytes << ") " << std::endl
+			<< " arena in use(" << arenaInUseBytes << ") " << std::endl
+			<< " arena free(" << arenaFreeBytes << ") " << std::endl
+			<< " total(" << Total() << ") " << std::endl;
 	}
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Residency hook. Component system notifies it before components of an entity are accessed,
+/// 	so entities which are not in memory can be loaded on first access.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class EntityResidency {
+public:
+	virtual ~EntityResidency() {}
+	virtual void Require( IN entity_t entityId ) = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Family storage. Family whose data is kept outside of component objects, in storage's own
+/// 	containers indexed by entity. Component system owns registered storages, keeps their rows in
+/// 	sync with entity deletion and enabled flag, and treats their families as any other family
+/// 	in queries. Storages supporting WriteRow and ReadRow can be evicted with world partitions.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class FamilyStorage {
+	family_t	mFamilyId;
+public:
+	FamilyStorage( IN family_t familyId ) : mFamilyId( familyId ) {}
+	virtual ~FamilyStorage() {}
+
+	family_t Family() const { return mFamilyId; }
+
+	virtual bool Insert( IN entity_t entityId ) = 0;
+	virtual bool Remove( IN entity_t entityId ) = 0;
+	virtual bool Contains( IN entity_t entityId ) const = 0;
+	virtual size_t Size() const = 0;
+	virtual void Reserve( IN size_t rows ) = 0;
+	virtual void Clear() = 0;
+	virtual size_t MemoryBytes() const = 0;
+
+	/// <summary>	Moves row of entity among enabled or disabled rows. Ignored by default. </summary>
+	virtual void SetEnabled( IN entity_t, IN bool ) {}
+	/// <summary>	Entity of each row. </summary>
+	virtual const entity_array& Entities() const = 0;
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Writes fields of row of given entity, or reads them back into row. Entity must have row.
+	/// 	Not supported by default.
+	/// </summary>
+	/// <returns>	true if it succeeds, false if it fails or storage doesn't support it. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	virtual bool WriteRow( IN entity_t, std::ostream& ) const	{ return false; }
+	virtual bool ReadRow( IN entity_t, std::istream& )			{ return false; }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Row index of family storage. Maps entities to dense rows, and keeps rows of enabled entities
+/// 	in front of rows of disabled ones, so bulk updates can run over enabled prefix only. Row
+/// 	data is owned by storage, every change of row order is passed to it as swap of two rows:
+/// 		size_t row = mRows.Insert( entityId, [this]( size_t a, size_t b ) { std::swap( mData[a], mData[b] ); } );
+/// 	Storage appends data of new row before Insert, and pops last row after Remove.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class FamilyRows {
+	/// <summary>	Entity of each row, and row of each entity plus one, zero when entity has none. </summary>
+	entity_array			mEntities;
+	std::vector< size_t >	mRows;
+	size_t					mEnabled;
+
+	template<typename Swap> void SwapRows( IN size_t a, IN size_t b, Swap& swap ) {
+		if( a == b )
+			return;
+
+		swap( a, b );
+		std::swap( mEntities[a], mEntities[b] );
+		mRows[ mEntities[a] ] = a + 1;
+		mRows[ mEntities[b] ] = b + 1;
+	}
+public:
+	FamilyRows() : mEnabled( 0 ) {}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Adds row of enabled entity. Entity must not have row yet. </summary>
+	/// <returns>	Row of entity. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Swap> size_t Insert( IN entity_t entityId, Swap swap ) {
+		if( entityId >= mRows.size() )
+			mRows.resize( entityId + 1, 0 );
+
+		mEntities.push_back( entityId );
+		mRows[ entityId ] = mEntities.size();
+		SwapRows( mEntities.size() - 1, mEnabled, swap );
+		return mEnabled++;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Moves row of entity to the end and removes it. Entity must have row. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Swap> void Remove( IN entity_t entityId, Swap swap ) {
+		size_t row = mRows[ entityId ] - 1;
+		if( row < mEnabled ) {
+			SwapRows( row, mEnabled - 1, swap );
+			row = --mEnabled;
+		}
+		SwapRows( row, mEntities.size() - 1, swap );
+
+		mEntities.pop_back();
+		mRows[ entityId ] = 0;
+	}
+
+	template<typename Swap> void SetEnabled( IN entity_t entityId, IN bool enabled, Swap swap ) {
+		if( !Contains( entityId ) )
+			return;
+
+		size_t row = mRows[ entityId ] - 1;
+		if( enabled && row >= mEnabled )
+			SwapRows( row, mEnabled++, swap );
+		else if( !enabled && row < mEnabled )
+			SwapRows( row, --mEnabled, swap );
+	}
+
+	bool Contains( IN entity_t entityId ) const {
+		return entityId < mRows.size() && mRows[ entityId ] != 0;
+	}
+
+	/// <summary>	Row of entity. Entity must have row. </summary>
+	size_t Row( IN entity_t entityId ) const		{ return mRows[ entityId ] - 1; }
+	size_t Size() const								{ return mEntities.size(); }
+	size_t EnabledSize() const						{ return mEnabled; }
+	const entity_array& Entities() const			{ return mEntities; }
+
+	void Reserve( IN size_t rows ) {
+		mEntities.reserve( rows );
+		mRows.reserve( rows + 1 );
+	}
+
+	void Clear() {
+		mEntities.clear();
+		mRows.clear();
+		mEnabled = 0;
+	}
+
+	size_t MemoryBytes() const {
+		return mEntities.capacity() * sizeof( entity_t ) + mRows.capacity() * sizeof( size_t );
+	}
+};
+
+typedef std::map< family_t, FamilyStorage* >		storage_map;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Order of components within family container. Sorted families are ordered by entity, and
+/// 	by unique id within one entity.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum FamilyOrder {
+	/// <summary>	Components are kept in order they were added. Default. </summary>
+	FAMILY_ORDER_INSERTION = 0,
+	/// <summary>	Each added component is inserted at its sorted position. </summary>
+	FAMILY_ORDER_SORTED,
+	/// <summary>	Components are appended, and family is sorted by SortFamilies at sync points. </summary>
+	FAMILY_ORDER_DEFERRED
+};
+
+struct FamilySorting {
+	FamilySorting() : order( FAMILY_ORDER_INSERTION ), dirty( false ) {}
+	FamilyOrder	order;
+	bool		dirty;
+};
+
+typedef std::map< family_t, FamilySorting >		sorting_map;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 /// <summary>	Component system. Class for handling component, and their memory management.  </summary>
@@ -195,20 +1027,204 @@ protected:
 private:
 	/// <summary>	component container. </summary>
 	component_vector mComponentArray;
-	/// <summary>	List of erased unique identifiers. </summary>
-	entity_list	mErasedIds;
+	/// <summary>	Used and erased unique identifiers, kept in sync with component container. </summary>
+	IdPool		mIds;
 
 	// used for faster fetching data based on entity ID and on family ID
 	std::vector< component_vector > mEntityComponentArray;
 	//component_map mEntityComponentMap;
 	component_map mFamilyComponentMap;
+
+	/// <summary>	Registered queries, and same queries indexed by each of their families. </summary>
+	query_vector	mQueries;
+	query_map		mQueriesByFamily;
+
+	/// <summary>	Memory for components, and scratch containers used while deleting entities. </summary>
+	ArenaPtr			mArena;
+	component_vector	mDeletedComponents;
+	entity_array		mDeletedEntities;
+
+	/// <summary>	Residency hook, NULL when all entities are always in memory. </summary>
+	EntityResidency*	mResidency;
+
+	inline void Require( IN entity_t entityId ) {
+		if( mResidency )
+			mResidency->Require( entityId );
+	}
+
+	/// <summary>	Tag families, and entities disabled for iteration and queries. </summary>
+	tag_map			mTagFamilies;
+	BitSet			mDisabled;
+	size_t			mDisabledCount;
+
+	/// <summary>	Families kept in their own storage, owned by system. </summary>
+	storage_map		mStorages;
+
+	/// <summary>	Size of component type of each family, recorded when family gets its first component. </summary>
+	std::map< family_t, size_t >	mFamilyPayloadSize;
+
+	template<typename Type> ComponentPtr MakeComponent() {
+		return std::allocate_shared<Type>( ArenaAllocator<Type>( mArena ) );
+	}
+
+	template<typename Type> void AddToFamily( IN ComponentPtr& component ) {
+		component_vector& family = mFamilyComponentMap[ component->mFamilyId ];
+		if( family.empty() )
+			mFamilyPayloadSize[ component->mFamilyId ] = sizeof( Type );
+		InsertIntoFamily( family, component );
+	}
+
+	/// <summary>	Families not kept in insertion order. Empty unless SetFamilyOrder was used. </summary>
+	sorting_map		mFamilySorting;
+
+	static bool EntityLess( IN ComponentPtr& a, IN ComponentPtr& b ) {
+		return a->mEntityId < b->mEntityId || ( a->mEntityId == b->mEntityId && a->mUniqueId < b->mUniqueId );
+	}
+
+	static bool EntityBefore( IN ComponentPtr& component, IN entity_t entityId )	{ return component->mEntityId < entityId; }
+	static bool EntityAfter( IN entity_t entityId, IN ComponentPtr& component )		{ return entityId < component->mEntityId; }
+
+	// sorting of family, or NULL when family is kept in insertion order
+	FamilySorting* Sorting( IN family_t familyId ) {
+		if( mFamilySorting.empty() )
+			return NULL;
+
+		sorting_map::iterator found = mFamilySorting.find( familyId );
+		return found != mFamilySorting.end() && found->second.order != FAMILY_ORDER_INSERTION ? &found->second : NULL;
+	}
+
+	bool IsSorted( IN family_t familyId ) {
+		FamilySorting* sorting = Sorting( familyId );
+		return sorting && !sorting->dirty;
+	}
+
+	void InsertIntoFamily( component_vector& family, IN ComponentPtr& component ) {
+		FamilySorting* sorting = Sorting( component->mFamilyId );
+		if( sorting == NULL || family.empty() || !EntityLess( component, family.back() ) )
+			family.push_back( component );
+		else if( sorting->order == FAMILY_ORDER_SORTED )
+			family.insert( std::upper_bound( family.begin(), family.end(), component, EntityLess ), component );
+		else {
+			family.push_back( component );
+			sorting->dirty = true;
+		}
+	}
+
+	// erases component from family, preserving order of the rest
+	bool EraseFromFamily( IN ComponentPtr& component ) {
+		component_vector& family = mFamilyComponentMap[ component->mFamilyId ];
+
+		if( IsSorted( component->mFamilyId ) ) {
+			component_vector::iterator found = std::lower_bound( family.begin(), family.end(), component, EntityLess );
+			if( found == family.end() || (*found)->mUniqueId != component->mUniqueId )
+				return false;
+
+			family.erase( found );
+			return true;
+		}
+
+		for( size_t i = 0; i < family.size(); i++ ) {
+			if( family[i]->mUniqueId == component->mUniqueId ) {
+				family.erase( family.begin() + i );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// queries are owned by system
+	ComponentSystem( IN ComponentSystem& );
+	ComponentSystem& operator=( IN ComponentSystem& );
+
+	// number of members of family, components are counted for component families
+	size_t CountFamilyMembers( IN family_t familyId ) {
+		tag_map::iterator tag = mTagFamilies.find( familyId );
+		if( tag != mTagFamilies.end() )
+			return tag->second.count;
+
+		storage_map::iterator storage = mStorages.find( familyId );
+		if( storage != mStorages.end() )
+			return storage->second->Size();
+
+		component_map::iterator family = mFamilyComponentMap.find( familyId );
+		return family != mFamilyComponentMap.end() ? family->second.size() : 0;
+	}
+
+	bool MatchesQuery( IN ComponentQuery* query, IN entity_t entityId ) {
+		if( !IsEnabled( entityId ) )
+			return false;
+
+		for( size_t i = 0; i < query->mFamilies.size(); i++ )
+			if( !HasFamily( entityId, query->mFamilies[i] ) )
+				return false;
+		return true;
+	}
+
+	// updates queries after component of given family is added to entity
+	void OnFamilyAdded( IN entity_t entityId, IN family_t familyId ) {
+		if( mQueriesByFamily.empty() )
+			return;
+
+		query_map::iterator found = mQueriesByFamily.find( familyId );
+		if( found == mQueriesByFamily.end() )
+			return;
+
+		for( size_t i = 0; i < found->second.size(); i++ ) {
+			ComponentQuery* query = found->second[i];
+			if( !query->Contains( entityId ) && MatchesQuery( query, entityId ) )
+				query->Insert( entityId );
+		}
+	}
+
+	// updates queries after component of given family is removed from entity
+	void OnFamilyRemoved( IN entity_t entityId, IN family_t familyId ) {
+		if( mQueriesByFamily.empty() )
+			return;
+
+		query_map::iterator found = mQueriesByFamily.find( familyId );
+		if( found == mQueriesByFamily.end() )
+			return;
+
+		// entity may still have other components of same family
+		if( HasFamily( entityId, familyId ) )
+			return;
+
+		for( size_t i = 0; i < found->second.size(); i++ ) {
+			if( found->second[i]->Contains( entityId ) )
+				found->second[i]->Remove( entityId );
+		}
+	}
+
+	// deletes entity with its components, tags and storage rows, children are left to caller
+	bool DeleteSingleEntity( IN entity_t entityId ) {
+		Require( entityId );
+
+		if( entitySystem.Delete( entityId ) ) 
+		{
+			DeleteComponentsByEntity( entityId );
+
+			for( tag_map::iterator it = mTagFamilies.begin(); it != mTagFamilies.end(); ++it )
+				RemoveTag( entityId, it->first );
+
+			for( storage_map::iterator it = mStorages.begin(); it != mStorages.end(); ++it )
+				DeleteRow( entityId, it->first );
+
+			if( !IsEnabled( entityId ) ) {
+				mDisabled.Reset( entityId );
+				mDisabledCount--;
+			}
+			return true;
+		}
+
+		return false;
+	}
 public:
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 	/// <summary>	Default constructor. </summary>
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	ComponentSystem() {
+	ComponentSystem() : mArena( new ComponentArena ), mResidency( NULL ), mDisabledCount( 0 ) {
 		mComponentArray.push_back( ComponentPtr() );
 
 		/// <summary>	The dummy component. Used for return values. Similar to smart NULL. </summary>
@@ -221,10 +1237,19 @@ public:
 
 	~ComponentSystem() {
 		mComponentArray.clear();
-		mErasedIds.clear();
+		mIds.Clear();
 		//mEntityComponentMap.clear();
 		mEntityComponentArray.clear();
 		mFamilyComponentMap.clear();
+
+		for( size_t i = 0; i < mQueries.size(); i++ )
+			delete mQueries[i];
+		mQueries.clear();
+		mQueriesByFamily.clear();
+
+		for( storage_map::iterator it = mStorages.begin(); it != mStorages.end(); ++it )
+			delete it->second;
+		mStorages.clear();
 	}
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -249,32 +1274,35 @@ public:
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	template<typename Type>	ComponentPtr CreateComponent( IN entity_t entityId ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::CreateComponent" );
+
+		Require( entityId );
 
 		// do we have erased components?
-		if( mErasedIds.empty() )
+		if( mIds.Empty() )
 		{
-			Type* newComponent = new Type;
+			ComponentPtr component = MakeComponent<Type>();
+			Component* newComponent = component.get();
 			
 			// no. put new component into the system
 			newComponent->mEntityId	= entityId;
-			mComponentArray.push_back( ComponentPtr( newComponent ) );
+			mComponentArray.push_back( component );
 
-			newComponent->mUniqueId = (cid_t)mComponentArray.size()-1;
+			newComponent->mUniqueId = (cid_t)mIds.Append();
 
 			// map to entity components
 			if( entityId >= mEntityComponentArray.size() )
 				mEntityComponentArray.resize( entityId + 1 );
 
 			mEntityComponentArray[ entityId ].push_back( mComponentArray.back() );
-			mFamilyComponentMap[ newComponent->mFamilyId ].push_back( mComponentArray.back() );
+			AddToFamily<Type>( mComponentArray.back() );
+			OnFamilyAdded( entityId, newComponent->mFamilyId );
 			return mComponentArray.back();
 		}
 		else
 		{
 			// yes. get old erased id then replace it with a new component
-			entity_t erasedId = mErasedIds.front();
-			mErasedIds.pop_front();
-			return Replace<Type>( erasedId, entityId );
+			return Replace<Type>( mIds.Acquire(), entityId );
 		}
 	}
 
@@ -286,12 +1314,14 @@ public:
 	inline bool AttachComponent( IN ComponentPtr& component )
 	{
 		mComponentArray.push_back( component );
+		mIds.Append();
 
 		if( component->mEntityId >= mEntityComponentArray.size() )
 			mEntityComponentArray.resize( component->mEntityId + 1 );
 
 		mEntityComponentArray[ component->mEntityId ].push_back( component );
-		mFamilyComponentMap[ component->mFamilyId ].push_back( component );
+		InsertIntoFamily( mFamilyComponentMap[ component->mFamilyId ], component );
+		OnFamilyAdded( component->mEntityId, component->mFamilyId );
 		return true;
 	}
 
@@ -303,6 +1333,7 @@ public:
 
 	ComponentSystem* AttachArray( IN component_vector& componentArray )
 	{
+		ECS_TRACE_SCOPE( "ComponentSystem::AttachArray" );
 		for( size_t i = 0;i <componentArray.size(); i++ ) {
 
 			AttachComponent( componentArray[i]);
@@ -347,26 +1378,32 @@ public:
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	template<typename Type>	ComponentPtr Replace( IN cid_t uniqueId, IN entity_t entityId ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::Replace" );
 		// only allow delete of the pointer in case there is no instance of object	
 		if( RefCount( uniqueId ) == 0 )
 		{
+			if( !mIds.IsUsed( uniqueId ) )
+				mIds.AcquireId( uniqueId );
+
 			if( uniqueId >= mComponentArray.size() )
 			{
-				mComponentArray.resize(uniqueId+1);
+				mComponentArray.resize( mIds.Size() );
 			}
 
-			Type* newComponent = new Type;
+			ComponentPtr component = MakeComponent<Type>();
+			Component* newComponent = component.get();
 			newComponent->mUniqueId = uniqueId;
 			newComponent->mEntityId = entityId;
 
 
-			mComponentArray[ uniqueId ] = ComponentPtr( newComponent );
+			mComponentArray[ uniqueId ] = component;
 
 			if( entityId >= mEntityComponentArray.size() )
 				mEntityComponentArray.resize( entityId + 1 );
 
 			mEntityComponentArray[ entityId ].push_back( mComponentArray[ uniqueId ] );
-			mFamilyComponentMap[ newComponent->mFamilyId ].push_back( mComponentArray[ uniqueId ] );
+			AddToFamily<Type>( mComponentArray[ uniqueId ] );
+			OnFamilyAdded( entityId, newComponent->mFamilyId );
 
 			return mComponentArray[ uniqueId ];
 		}
@@ -388,6 +1425,7 @@ public:
 
 	bool Release( IN cid_t uniqueId )
 	{
+		ECS_TRACE_SCOPE( "ComponentSystem::Release" );
 		// only allow delete of the pointer in case there is 
 		// only one instance of object in each of:
 		if( RefCount( uniqueId ) == 0 )
@@ -403,17 +1441,11 @@ public:
 			}
 
 			family_t familyId = mComponentArray[uniqueId]->mFamilyId;
-			for( entity_t i = 0; i<mFamilyComponentMap[ familyId ].size(); i++ )
-			{
-				if( mFamilyComponentMap[ familyId ][ i ]->mUniqueId == uniqueId )
-				{
-					mFamilyComponentMap[ familyId ].erase( mFamilyComponentMap[ familyId ].begin() + i );
-					break;
-				}
-			}
+			EraseFromFamily( mComponentArray[uniqueId] );
 			// clear but don't erase
 			mComponentArray[ uniqueId ].reset();
-			mErasedIds.push_back( uniqueId );
+			mIds.Release( uniqueId );
+			OnFamilyRemoved( entityId, familyId );
 			return true;
 		}
 
@@ -466,13 +1498,19 @@ public:
 
 	void GetComponentsByEntity( IN entity_t entityId, OUT component_vector& componentsList )
 	{
-		componentsList = mEntityComponentArray[ entityId ];
+		ECS_TRACE_SCOPE( "ComponentSystem::GetComponentsByEntity" );
+		Require( entityId );
+		if( entityId < mEntityComponentArray.size() )
+			componentsList = mEntityComponentArray[ entityId ];
+		else
+			componentsList.clear();
 	}
 
 	void AppendComponentsByEntity( IN entity_t entityId, OUT component_vector& componentsList )
 	{
+		Require( entityId );
 		if( entityId >= mEntityComponentArray.size() )
-			mEntityComponentArray.resize( entityId + 1 );
+			return;
 
 		componentsList.insert( componentsList.end(), mEntityComponentArray[ entityId ].begin(), mEntityComponentArray[ entityId ].end() );
 	}
@@ -485,7 +1523,22 @@ public:
 
 	void GetComponentsByFamily( IN family_t familyId, OUT component_vector& componentsList )
 	{
-		componentsList = mFamilyComponentMap[ familyId ];
+		ECS_TRACE_SCOPE( "ComponentSystem::GetComponentsByFamily" );
+		componentsList.clear();
+		component_map::iterator found = mFamilyComponentMap.find( familyId );
+		if( found == mFamilyComponentMap.end() )
+			return;
+
+		component_vector& family = found->second;
+		if( mDisabledCount == 0 ) {
+			componentsList = family;
+			return;
+		}
+
+		// skip components of disabled entities
+		for( size_t i = 0; i < family.size(); i++ )
+			if( IsEnabled( family[i]->mEntityId ) )
+				componentsList.push_back( family[i] );
 	}
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -497,6 +1550,10 @@ public:
 
 	void GetComponentsByEntityAndFamily( IN entity_t entityId, IN family_t familyId, OUT component_vector& componentsList )
 	{
+		Require( entityId );
+		if( entityId >= mEntityComponentArray.size() )
+			return;
+
 		for( entity_t i =0; i< mEntityComponentArray[entityId].size(); i++ )
 			if( mEntityComponentArray[ entityId ][i]->mFamilyId == familyId )
 				componentsList.push_back( mEntityComponentArray[ entityId ][i] );
@@ -529,11 +1586,205 @@ public:
 	/// <param name="componentsList">	[in,out] List of components. </param>
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	void GetComponentsByFamilyAndEntity( IN entity_t entityId, IN family_t familyId, OUT component_vector& componentsList )
+	void GetComponentsByFamilyAndEntity( IN entity_t entityId, IN family_t familyId, OUT component_vector& componentsList )
+	{
+		ECS_TRACE_SCOPE( "ComponentSystem::GetComponentsByFamilyAndEntity" );
+		component_map::iterator found = mFamilyComponentMap.find( familyId );
+		if( found == mFamilyComponentMap.end() )
+			return;
+
+		component_vector& family = found->second;
+		if( IsSorted( familyId ) ) {
+			componentsList.insert( componentsList.end(),
+				std::lower_bound( family.begin(), family.end(), entityId, EntityBefore ),
+				std::upper_bound( family.begin(), family.end(), entityId, EntityAfter ) );
+			return;
+		}
+
+		for( size_t i = 0; i < family.size(); i++ )
+			if( family[i]->mEntityId == entityId )
+				componentsList.push_back( family[i] );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Sets order of components within family container. Family is sorted right away when it
+	/// 	switches to sorted or deferred order. Sorted families find components of one entity with
+	/// 	binary search, iterate in entity order, and can be merged with JoinFamilies.
+	/// </summary>
+	///
+	/// <param name="familyId">	Identifier for the family. </param>
+	/// <param name="order">   	The order. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void SetFamilyOrder( IN family_t familyId, IN FamilyOrder order ) {
+		if( order == FAMILY_ORDER_INSERTION ) {
+			mFamilySorting.erase( familyId );
+			return;
+		}
+
+		FamilySorting& sorting = mFamilySorting[ familyId ];
+		sorting.order = order;
+		sorting.dirty = true;
+		SortFamilies();
+	}
+
+	FamilyOrder GetFamilyOrder( IN family_t familyId ) {
+		FamilySorting* sorting = Sorting( familyId );
+		return sorting ? sorting->order : FAMILY_ORDER_INSERTION;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Sorts families with deferred order which got components out of order since last sort.
+	/// 	Call it at sync points, e.g. once per tick. Until then, lookups in such family fall back
+	/// 	to linear search, and it can't be joined. Lookups never sort on their own, so they can
+	/// 	be called from systems running in parallel.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void SortFamilies() {
+		ECS_TRACE_SCOPE( "ComponentSystem::SortFamilies" );
+		for( sorting_map::iterator it = mFamilySorting.begin(); it != mFamilySorting.end(); ++it ) {
+			if( !it->second.dirty )
+				continue;
+
+			component_map::iterator family = mFamilyComponentMap.find( it->first );
+			if( family != mFamilyComponentMap.end() )
+				std::sort( family->second.begin(), family->second.end(), EntityLess );
+			it->second.dirty = false;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Joins sorted families with single linear merge pass. Function is called in increasing
+	/// 	entity order for each enabled entity having component in every family, with first
+	/// 	component of each family, in order families were given:
+	/// 		JoinFamilies( families, [&]( entity_t entityId, const component_vector& components ) {
+	/// 			smart_cast<Health*>( components[0] )->health -= smart_cast<Attack*>( components[1] )->strength;
+	/// 		} );
+	/// 	Function must not add or remove components of joined families. Deferred families must
+	/// 	be sorted by SortFamilies first.
+	/// </summary>
+	///
+	/// <param name="families">	Families to join. </param>
+	/// <param name="function">	Function called for each joined entity. </param>
+	///
+	/// <returns>	false if some of families is kept in insertion order or isn't sorted yet, true otherwise. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Function> bool JoinFamilies( IN std::vector< family_t >& families, Function function ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::JoinFamilies" );
+		for( size_t i = 0; i < families.size(); i++ )
+			if( !IsSorted( families[i] ) )
+				return false;
+
+		if( families.empty() )
+			return true;
+
+		size_t count = families.size();
+		std::vector< component_vector* > lists( count );
+		std::vector< size_t > cursors( count, 0 );
+		component_vector joined( count );
+		for( size_t i = 0; i < count; i++ ) {
+			component_map::iterator found = mFamilyComponentMap.find( families[i] );
+			if( found == mFamilyComponentMap.end() )
+				return true;
+			lists[i] = &found->second;
+		}
+
+		for( ;; ) {
+			// every family is advanced to highest entity under cursors
+			entity_t target = 0;
+			for( size_t i = 0; i < count; i++ ) {
+				if( cursors[i] == lists[i]->size() )
+					return true;
+				target = std::max( target, (*lists[i])[ cursors[i] ]->mEntityId );
+			}
+
+			bool matched = true;
+			for( size_t i = 0; i < count; i++ ) {
+				component_vector& list = *lists[i];
+				while( cursors[i] < list.size() && list[ cursors[i] ]->mEntityId < target )
+					cursors[i]++;
+
+				if( cursors[i] == list.size() )
+					return true;
+				if( list[ cursors[i] ]->mEntityId != target )
+					matched = false;
+				else
+					joined[i] = list[ cursors[i] ];
+			}
+
+			if( !matched )
+				continue;
+
+			if( IsEnabled( target ) )
+				function( target, (const component_vector&)joined );
+
+			for( size_t i = 0; i < count; i++ )
+				while( cursors[i] < lists[i]->size() && (*lists[i])[ cursors[i] ]->mEntityId == target )
+					cursors[i]++;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Finds next component of enabled entity in family, following component identified by given
+	/// 	entity and unique id. Sorted and deferred families are walked in entity order with binary
+	/// 	search, or with linear search while deferred family waits for SortFamilies. Others are
+	/// 	walked in unique id order, which takes linear time in size of family. Position is given
+	/// 	by identifiers rather than by index, so it stays valid while components are created and
+	/// 	deleted. Pass zeroes to find first component.
+	/// </summary>
+	///
+	/// <param name="familyId">	Identifier for the family. </param>
+	/// <param name="entityId">	Entity of previous component. </param>
+	/// <param name="uniqueId">	Unique id of previous component. </param>
+	///
+	/// <returns>	The next component, or empty pointer at end of family. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ComponentPtr FindNextComponentByFamily( IN family_t familyId, IN entity_t entityId, IN cid_t uniqueId )
 	{
-		for( family_t i =0; i< mFamilyComponentMap[familyId].size(); i++ )
-			if( mFamilyComponentMap[ familyId ][i]->mEntityId == entityId )
-				componentsList.push_back( mFamilyComponentMap[ familyId ][i] );
+		component_map::iterator family = mFamilyComponentMap.find( familyId );
+		if( family == mFamilyComponentMap.end() )
+			return mComponentArray[0];
+
+		FamilySorting* sorting = Sorting( familyId );
+		if( sorting && !sorting->dirty ) {
+			component_vector::iterator next = std::upper_bound( family->second.begin(), family->second.end(), entityId,
+				[uniqueId]( entity_t previous, IN ComponentPtr& component ) {
+					return previous < component->mEntityId || ( previous == component->mEntityId && uniqueId < component->mUniqueId );
+				} );
+
+			for( ; next != family->second.end(); ++next )
+				if( IsEnabled( (*next)->mEntityId ) )
+					return *next;
+
+			return mComponentArray[0];
+		}
+
+		ComponentPtr* next = NULL;
+		if( sorting ) {
+			// lowest component following given one in entity order
+			for( component_vector::iterator it = family->second.begin(); it != family->second.end(); ++it ) {
+				IN ComponentPtr& component = *it;
+				bool after = component->mEntityId > entityId || ( component->mEntityId == entityId && component->mUniqueId > uniqueId );
+				if( after && ( next == NULL || EntityLess( component, *next ) ) && IsEnabled( component->mEntityId ) )
+					next = &*it;
+			}
+			return next ? *next : mComponentArray[0];
+		}
+
+		// insertion order doesn't follow unique ids, which are reused, so whole family is checked
+		for( component_vector::iterator it = family->second.begin(); it != family->second.end(); ++it ) {
+			if( (*it)->mUniqueId > uniqueId && ( next == NULL || (*it)->mUniqueId < (*next)->mUniqueId ) && IsEnabled( (*it)->mEntityId ) )
+				next = &*it;
+		}
+
+		return next ? *next : mComponentArray[0];
 	}
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -547,6 +1798,8 @@ public:
 
 	ComponentPtr FindFirstComponentByEntityAndFamily( IN entity_t entityId, IN family_t familyId )
 	{
+		ECS_TRACE_SCOPE( "ComponentSystem::FindFirstComponentByEntityAndFamily" );
+		Require( entityId );
 		if( entityId < mEntityComponentArray.size() )
 		{
 			for( entity_t i =0; i< mEntityComponentArray[entityId].size(); i++ )
@@ -563,8 +1816,13 @@ public:
 
 	ComponentPtr FindFirstComponentByFamily( IN family_t familyId )
 	{
-		if( mFamilyComponentMap[familyId].size() ) {
-			return mFamilyComponentMap[ familyId ][0];
+		component_map::iterator found = mFamilyComponentMap.find( familyId );
+		if( found == mFamilyComponentMap.end() )
+			return mComponentArray[0];
+
+		for( size_t i = 0; i < found->second.size(); i++ ) {
+			if( IsEnabled( found->second[i]->mEntityId ) )
+				return found->second[i];
 		}
 
 		return mComponentArray[0];
@@ -575,12 +1833,31 @@ public:
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	void Clear() {
+		ECS_TRACE_SCOPE( "ComponentSystem::Clear" );
 
 		mComponentArray.clear();
-		mErasedIds.clear();
+		mIds.Clear();
 		mEntityComponentArray.clear();
 		mFamilyComponentMap.clear();
 
+		// queries and tag families stay registered, but without any entity
+		for( size_t i = 0; i < mQueries.size(); i++ )
+			mQueries[i]->Clear();
+
+		for( tag_map::iterator it = mTagFamilies.begin(); it != mTagFamilies.end(); ++it ) {
+			it->second.entities.Clear();
+			it->second.count = 0;
+		}
+		mDisabled.Clear();
+		mDisabledCount = 0;
+
+		// families keep their order, and are sorted while empty
+		for( sorting_map::iterator it = mFamilySorting.begin(); it != mFamilySorting.end(); ++it )
+			it->second.dirty = false;
+
+		for( storage_map::iterator it = mStorages.begin(); it != mStorages.end(); ++it )
+			it->second->Clear();
+
 		/// <summary>	The dummy component. Used for return values. </summary>
 		mComponentArray.push_back( ComponentPtr() );
 		mComponentArray[0].reset();
@@ -588,7 +1865,150 @@ public:
 	}
 
 	void Resize( size_t size ) {
-		mComponentArray.resize( size );
+		mIds.Resize( (unsigned int)size );
+		mComponentArray.resize( mIds.Size() );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Reserves capacity of all internal containers. Entity rows are created up front for given
+	/// 	number of entities, and family containers reserved for every family known so far or given
+	/// 	in families list. Together with ReserveComponents, creating and deleting entities and
+	/// 	components within reserved capacity performs no heap allocation.
+	/// </summary>
+	///
+	/// <param name="entities">			  	Number of entities. </param>
+	/// <param name="componentsPerFamily">	Number of components in each family. </param>
+	/// <param name="families">			  	Families to reserve besides already known ones. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Reserve( IN entity_t entities, IN size_t componentsPerFamily, IN std::vector< family_t >& families = std::vector< family_t >() ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::Reserve" );
+		for( size_t i = 0; i < families.size(); i++ )
+			mFamilyComponentMap[ families[i] ];
+
+		size_t familyCount = mFamilyComponentMap.size();
+		for( component_map::iterator it = mFamilyComponentMap.begin(); it != mFamilyComponentMap.end(); ++it )
+			it->second.reserve( componentsPerFamily );
+
+		size_t components = componentsPerFamily * familyCount + 1;
+		mComponentArray.reserve( components );
+		mIds.Reserve( (unsigned int)components );
+
+		// entity ids start at 1, so per entity structures have one slot more
+		entitySystem.Reserve( entities );
+		if( mEntityComponentArray.size() < entities + 1 )
+			mEntityComponentArray.resize( entities + 1 );
+		for( size_t i = 0; i < mEntityComponentArray.size(); i++ )
+			mEntityComponentArray[i].reserve( familyCount );
+		mDeletedComponents.reserve( familyCount );
+
+		for( size_t i = 0; i < mQueries.size(); i++ )
+			mQueries[i]->Reserve( entities );
+
+		for( tag_map::iterator it = mTagFamilies.begin(); it != mTagFamilies.end(); ++it )
+			it->second.entities.Reserve( entities + 1 );
+		mDisabled.Reserve( entities + 1 );
+
+		for( storage_map::iterator it = mStorages.begin(); it != mStorages.end(); ++it )
+			it->second->Reserve( entities );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Reserves component memory for given number of components of given type. </summary>
+	///
+	/// <typeparam name="typename Type">	Type of the component. </typeparam>
+	/// <param name="count">	Number of components. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Type> void ReserveComponents( IN size_t count ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::ReserveComponents" );
+		// block holds component together with its reference count, measure it on one component
+		size_t inUse = mArena->BytesInUse();
+		ComponentPtr probe = MakeComponent<Type>();
+		size_t bytes = mArena->BytesInUse() - inUse;
+
+		// family is known from component constructor, record it up front
+		mFamilyPayloadSize[ probe->mFamilyId ] = sizeof( Type );
+		probe.reset();
+
+		mArena->Reserve( bytes, count );
+	}
+
+	const ComponentArena& Arena() const {
+		return *mArena;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Reports memory used by component system, by family (payload and overhead), by index
+	/// 	structure, and by erased and reserved capacity.
+	/// </summary>
+	///
+	/// <returns>	Memory report. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	MemoryUsage MemoryReport() {
+		// red-black tree node: color, parent, left and right links
+		const size_t mapNode = 4 * sizeof( void* );
+		// in place reference count block: vtable, use and weak count, allocator
+		const size_t controlBlock = sizeof( void* ) + 2 * sizeof( int ) + sizeof( ArenaAllocator<Component> );
+		const size_t pointer = sizeof( ComponentPtr );
+
+		MemoryUsage usage;
+
+		for( component_map::iterator it = mFamilyComponentMap.begin(); it != mFamilyComponentMap.end(); ++it ) {
+			FamilyMemory family;
+			family.familyId			= it->first;
+			family.components		= it->second.size();
+			family.componentSize	= 0;
+
+			std::map< family_t, size_t >::iterator size = mFamilyPayloadSize.find( it->first );
+			if( size != mFamilyPayloadSize.end() )
+				family.componentSize = size->second;
+
+			// block holds component and reference counts, rounded to arena granularity
+			size_t block = ( ( family.componentSize + controlBlock + 15 ) / 16 ) * 16;
+			family.payloadBytes		= family.components * family.componentSize;
+			// each component is held by component array, entity row and family container
+			family.overheadBytes	= family.components * ( block - family.componentSize + 3 * pointer );
+			usage.families.push_back( family );
+
+			usage.familyMapBytes	+= mapNode + sizeof( component_map::value_type ) + it->second.capacity() * pointer;
+			usage.slackBytes		+= ( it->second.capacity() - it->second.size() ) * pointer;
+		}
+		usage.familyMapBytes += mFamilyPayloadSize.size() * ( mapNode + sizeof( std::map< family_t, size_t >::value_type ) );
+
+		usage.componentArrayBytes	= mComponentArray.capacity() * pointer;
+		usage.erasedBytes			= mIds.FreeCount() * pointer;
+		usage.slackBytes			+= ( mComponentArray.capacity() - mComponentArray.size() ) * pointer;
+
+		usage.entityRowBytes = mEntityComponentArray.capacity() * sizeof( component_vector ) + mDeletedComponents.capacity() * pointer;
+		usage.slackBytes += ( mEntityComponentArray.capacity() - mEntityComponentArray.size() ) * sizeof( component_vector );
+		for( size_t i = 0; i < mEntityComponentArray.size(); i++ ) {
+			usage.entityRowBytes	+= mEntityComponentArray[i].capacity() * pointer;
+			usage.slackBytes		+= ( mEntityComponentArray[i].capacity() - mEntityComponentArray[i].size() ) * pointer;
+		}
+
+		usage.componentIdBytes	= mIds.MemoryBytes();
+		usage.entityIdBytes		= entitySystem.MemoryBytes();
+
+		usage.queryBytes = mQueries.capacity() * sizeof( ComponentQuery* );
+		for( size_t i = 0; i < mQueries.size(); i++ )
+			usage.queryBytes += mQueries[i]->MemoryBytes();
+		for( query_map::iterator it = mQueriesByFamily.begin(); it != mQueriesByFamily.end(); ++it )
+			usage.queryBytes += mapNode + sizeof( query_map::value_type ) + it->second.capacity() * sizeof( ComponentQuery* );
+
+		usage.tagBytes = mDisabled.MemoryBytes();
+		for( tag_map::iterator it = mTagFamilies.begin(); it != mTagFamilies.end(); ++it )
+			usage.tagBytes += mapNode + sizeof( tag_map::value_type ) + it->second.entities.MemoryBytes();
+
+		for( storage_map::iterator it = mStorages.begin(); it != mStorages.end(); ++it )
+			usage.storageBytes += mapNode + sizeof( storage_map::value_type ) + it->second->MemoryBytes();
+
+		usage.arenaInUseBytes	= mArena->BytesInUse();
+		usage.arenaFreeBytes	= mArena->BytesFree();
+		return usage;
 	}
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -616,11 +2036,13 @@ public:
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	void RebuildErasedIDs() {
-		mErasedIds.clear();
+		ECS_TRACE_SCOPE( "ComponentSystem::RebuildErasedIDs" );
+		mIds.Clear();
+		mIds.Resize( Size() );
 		for( entity_t i = 1; i<Size(); i++ )
 		{
-			if( !mComponentArray[i] )	// or use_count() == 0 ?
-				mErasedIds.push_back(i);
+			if( mComponentArray[i] )	// or use_count() == 0 ?
+				mIds.AcquireId(i);
 		}
 	}
 
@@ -638,7 +2060,7 @@ public:
 	}
 
 	entity_t ErasedIDSize() {
-		return mErasedIds.size();
+		return mIds.FreeCount();
 	}
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -652,6 +2074,7 @@ public:
 
 	entity_t CountComponentsByEntityAndFamily( IN entity_t entityId, IN family_t familyId )
 	{
+		Require( entityId );
 		entity_t size = 0;
 		for( entity_t i =0; i< mEntityComponentArray[entityId].size(); i++ )
 			if( mEntityComponentArray[ entityId ][i]->mFamilyId == familyId )
@@ -660,23 +2083,389 @@ public:
 		return size;
 	}
 
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Query if entity has at least one component of given family. </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="familyId">	Identifier for the family. </param>
+	///
+	/// <returns>	true if entity has component of given family, false if not. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool HasFamily( IN entity_t entityId, IN family_t familyId )
+	{
+		if( mTagFamilies.empty() == false )
+		{
+			tag_map::iterator tag = mTagFamilies.find( familyId );
+			if( tag != mTagFamilies.end() )
+				return tag->second.entities.Test( entityId );
+		}
+
+		if( mStorages.empty() == false )
+		{
+			storage_map::iterator storage = mStorages.find( familyId );
+			if( storage != mStorages.end() )
+				return storage->second->Contains( entityId );
+		}
+
+		if( entityId < mEntityComponentArray.size() )
+		{
+			for( entity_t i =0; i< mEntityComponentArray[entityId].size(); i++ )
+				if( mEntityComponentArray[ entityId ][i]->mFamilyId == familyId )
+					return true;
+		}
+		return false;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Registers query over given families. Query is filled with currently matching entities, and
+	/// 	kept up to date afterwards. Query is owned by component system, and is valid until it is
+	/// 	unregistered or component system is destroyed.
+	/// </summary>
+	///
+	/// <param name="families">	Families each matching entity must have. </param>
+	///
+	/// <returns>	Registered query. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ComponentQuery* RegisterQuery( IN std::vector< family_t >& families )
+	{
+		ECS_TRACE_SCOPE( "ComponentSystem::RegisterQuery" );
+		ComponentQuery* query = new ComponentQuery( families );
+		mQueries.push_back( query );
+
+		for( size_t i = 0; i < families.size(); i++ ) {
+			query_vector& queries = mQueriesByFamily[ families[i] ];
+			if( queries.empty() || queries.back() != query )
+				queries.push_back( query );
+		}
+
+		if( families.empty() )
+			return query;
+
+		// fill query from its smallest family
+		family_t smallest = families[0];
+		for( size_t i = 1; i < families.size(); i++ )
+			if( CountFamilyMembers( families[i] ) < CountFamilyMembers( smallest ) )
+				smallest = families[i];
+
+		tag_map::iterator tag = mTagFamilies.find( smallest );
+		if( tag != mTagFamilies.end() ) {
+			tag->second.entities.ForEach( [&]( entity_t entityId ) {
+				if( MatchesQuery( query, entityId ) )
+					query->Insert( entityId );
+			} );
+			return query;
+		}
+
+		storage_map::iterator storage = mStorages.find( smallest );
+		if( storage != mStorages.end() ) {
+			const entity_array& entities = storage->second->Entities();
+			for( size_t i = 0; i < entities.size(); i++ )
+				if( MatchesQuery( query, entities[i] ) )
+					query->Insert( entities[i] );
+			return query;
+		}
+
+		component_map::iterator family = mFamilyComponentMap.find( smallest );
+		if( family == mFamilyComponentMap.end() )
+			return query;
+
+		component_vector& candidates = family->second;
+		for( size_t i = 0; i < candidates.size(); i++ ) {
+			entity_t entityId = candidates[i]->mEntityId;
+			if( !query->Contains( entityId ) && MatchesQuery( query, entityId ) )
+				query->Insert( entityId );
+		}
+
+		return query;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Unregisters and destroys query. </summary>
+	///
+	/// <param name="query">	Query returned by RegisterQuery. </param>
+	///
+	/// <returns>	true if it succeeds, false if query is not registered. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool UnregisterQuery( ComponentQuery* query )
+	{
+		for( size_t i = 0; i < mQueries.size(); i++ ) {
+			if( mQueries[i] == query ) {
+				mQueries.erase( mQueries.begin() + i );
+
+				for( size_t f = 0; f < query->mFamilies.size(); f++ ) {
+					query_vector& queries = mQueriesByFamily[ query->mFamilies[f] ];
+					for( size_t q = 0; q < queries.size(); q++ ) {
+						if( queries[q] == query ) {
+							queries.erase( queries.begin() + q );
+							break;
+						}
+					}
+					if( queries.empty() )
+						mQueriesByFamily.erase( query->mFamilies[f] );
+				}
+
+				delete query;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Declares tag family. Tags are markers without data, stored as one bit per entity. Tag
+	/// 	families can be used in queries as any other family. Declaring tags up front, before
+	/// 	Reserve, keeps tagging free of heap allocation.
+	/// </summary>
+	///
+	/// <param name="tagId">	Identifier for the tag family. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void DeclareTagFamily( IN family_t tagId ) {
+		mTagFamilies[ tagId ];
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Adds tag to entity. Tag family is declared if it wasn't already. </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="tagId">   	Identifier for the tag family. </param>
+	///
+	/// <returns>	true if tag was added, false if entity doesn't exist or already had it. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool AddTag( IN entity_t entityId, IN family_t tagId ) {
+		Require( entityId );
+		if( !entitySystem.Exist( entityId ) )
+			return false;
+
+		TagFamily& tag = mTagFamilies[ tagId ];
+		if( tag.entities.Test( entityId ) )
+			return false;
+
+		tag.entities.Set( entityId );
+		tag.count++;
+		OnFamilyAdded( entityId, tagId );
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Removes tag from entity. </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="tagId">   	Identifier for the tag family. </param>
+	///
+	/// <returns>	true if tag was removed, false if entity didn't have it. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool RemoveTag( IN entity_t entityId, IN family_t tagId ) {
+		Require( entityId );
+		tag_map::iterator tag = mTagFamilies.find( tagId );
+		if( tag == mTagFamilies.end() || !tag->second.entities.Test( entityId ) )
+			return false;
+
+		tag->second.entities.Reset( entityId );
+		tag->second.count--;
+		OnFamilyRemoved( entityId, tagId );
+		return true;
+	}
+
+	bool HasTag( IN entity_t entityId, IN family_t tagId ) {
+		Require( entityId );
+		tag_map::iterator tag = mTagFamilies.find( tagId );
+		return tag != mTagFamilies.end() && tag->second.entities.Test( entityId );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Gets tag families of given entity. </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="tags">	   	[out] Tag families. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void GetTagsByEntity( IN entity_t entityId, OUT std::vector< family_t >& tags ) {
+		Require( entityId );
+		tags.clear();
+		for( tag_map::iterator it = mTagFamilies.begin(); it != mTagFamilies.end(); ++it )
+			if( it->second.entities.Test( entityId ) )
+				tags.push_back( it->first );
+	}
+
+	bool IsTagFamily( IN family_t familyId ) {
+		return mTagFamilies.find( familyId ) != mTagFamilies.end();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Gets enabled entities having given tag, in increasing order. </summary>
+	///
+	/// <param name="tagId">   	Identifier for the tag family. </param>
+	/// <param name="entities">	[out] Tagged entities. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void GetEntitiesByTag( IN family_t tagId, OUT entity_array& entities ) {
+		entities.clear();
+
+		tag_map::iterator tag = mTagFamilies.find( tagId );
+		if( tag == mTagFamilies.end() )
+			return;
+
+		entities.reserve( tag->second.count );
+		tag->second.entities.ForEach( [&]( entity_t entityId ) {
+			if( IsEnabled( entityId ) )
+				entities.push_back( entityId );
+		} );
+	}
+
+	size_t CountEntitiesByTag( IN family_t tagId ) {
+		tag_map::iterator tag = mTagFamilies.find( tagId );
+		return tag != mTagFamilies.end() ? tag->second.count : 0;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Enables or disables entity. Disabled entity keeps its components and tags, but is skipped
+	/// 	by family iteration, tag iteration and queries. Lookups by entity still find it. Its
+	/// 	storage rows are moved behind rows of enabled entities. Ignored for entities which don't
+	/// 	exist.
+	/// </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="enabled"> 	true to enable, false to disable. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void SetEnabled( IN entity_t entityId, IN bool enabled ) {
+		Require( entityId );
+		if( enabled == IsEnabled( entityId ) || !entitySystem.Exist( entityId ) )
+			return;
+
+		if( enabled ) {
+			mDisabled.Reset( entityId );
+			mDisabledCount--;
+
+			for( size_t i = 0; i < mQueries.size(); i++ )
+				if( !mQueries[i]->Contains( entityId ) && MatchesQuery( mQueries[i], entityId ) )
+					mQueries[i]->Insert( entityId );
+		}
+		else {
+			mDisabled.Set( entityId );
+			mDisabledCount++;
+
+			for( size_t i = 0; i < mQueries.size(); i++ )
+				if( mQueries[i]->Contains( entityId ) )
+					mQueries[i]->Remove( entityId );
+		}
+
+		for( storage_map::iterator it = mStorages.begin(); it != mStorages.end(); ++it )
+			it->second->SetEnabled( entityId, enabled );
+	}
+
+	bool IsEnabled( IN entity_t entityId ) const {
+		return mDisabledCount == 0 || !mDisabled.Test( entityId );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Registers family storage. Storage is owned by component system from now on, and replaces
+	/// 	previously registered storage of same family.
+	/// </summary>
+	///
+	/// <param name="storage">	[in] Storage, allocated with new. </param>
+	///
+	/// <returns>	Registered storage. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Storage> Storage* RegisterStorage( Storage* storage ) {
+		FamilyStorage*& registered = mStorages[ storage->Family() ];
+		delete registered;
+		registered = storage;
+		return storage;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Gets storages holding row of given entity. </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="storages">	[out] Storages. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void GetStoragesByEntity( IN entity_t entityId, OUT std::vector< FamilyStorage* >& storages ) {
+		Require( entityId );
+		storages.clear();
+		for( storage_map::iterator it = mStorages.begin(); it != mStorages.end(); ++it )
+			if( it->second->Contains( entityId ) )
+				storages.push_back( it->second );
+	}
+
+	template<typename Storage> Storage* GetStorage( IN family_t familyId ) {
+		storage_map::iterator found = mStorages.find( familyId );
+		return found != mStorages.end() ? static_cast< Storage* >( found->second ) : NULL;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Finds storage of given family holding row of entity. Storage rows are not components, so
+	/// 	this is their counterpart of FindFirstComponentByEntityAndFamily.
+	/// </summary>
+	///
+	/// <returns>	Storage, or NULL if there is no such storage or entity has no row in it. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Storage> Storage* FindStorageByEntityAndFamily( IN entity_t entityId, IN family_t familyId ) {
+		storage_map::iterator found = mStorages.find( familyId );
+		if( found == mStorages.end() || !found->second->Contains( entityId ) )
+			return NULL;
+
+		return static_cast< Storage* >( found->second );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Creates row for entity in storage of given family. </summary>
+	///
+	/// <param name="entityId">	Identifier for the entity. </param>
+	/// <param name="familyId">	Identifier for the storage family. </param>
+	///
+	/// <returns>	true if row was created, false if there is no such storage or entity already has row. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool CreateRow( IN entity_t entityId, IN family_t familyId ) {
+		storage_map::iterator found = mStorages.find( familyId );
+		if( found == mStorages.end() )
+			return false;
+
+		Require( entityId );
+		if( !found->second->Insert( entityId ) )
+			return false;
+
+		if( !IsEnabled( entityId ) )
+			found->second->SetEnabled( entityId, false );
+
+		OnFamilyAdded( entityId, familyId );
+		return true;
+	}
+
+	bool DeleteRow( IN entity_t entityId, IN family_t familyId ) {
+		storage_map::iterator found = mStorages.find( familyId );
+		if( found == mStorages.end() || !found->second->Remove( entityId ) )
+			return false;
+
+		OnFamilyRemoved( entityId, familyId );
+		return true;
+	}
+
 	bool DeleteComponent( IN cid_t componentId ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::DeleteComponent" );
 
-		if( componentId < mComponentArray.size() )
+		if( componentId < mComponentArray.size() && mComponentArray[ componentId ] )
 		{
 			family_t componentFamily	= mComponentArray[ componentId ]->mFamilyId;
 			entity_t entityType			= mComponentArray[ componentId ]->mEntityId;
 			entity_t uniqueId			= mComponentArray[ componentId ]->mUniqueId;
 
-			bool erased = false;
-			for( size_t i = 0; i<mFamilyComponentMap[ componentFamily ].size(); i++ ){
-				if( mFamilyComponentMap[ componentFamily ][i]->mUniqueId == uniqueId ) {
-
-					mFamilyComponentMap[ componentFamily ].erase(mFamilyComponentMap[ componentFamily ].begin() + i);
-					erased = true;
-					break;
-				}
-			}
+			bool erased = EraseFromFamily( mComponentArray[ componentId ] );
 
 			if( !erased )
 				return false;
@@ -694,16 +2483,18 @@ public:
 			if( !erased )
 				return false;
 			mComponentArray[ componentId ].reset();
-			// if last component doesn't need to be put under erased ID's
-			if( componentId == mComponentArray.size()-1 )
-				mComponentArray.pop_back();
-			else
-				mErasedIds.push_back( componentId );
+			// last components don't need to be kept under erased ID's
+			mIds.Release( componentId );
+			mComponentArray.resize( mIds.Trim() );
+			OnFamilyRemoved( entityType, componentFamily );
 		}
 		return true;
 	}
 	////////////////////////////////////////////////////////////////////////////////////////////////////
-	/// <summary>	Deletes the given entity based on entityId. </summary>
+	/// <summary>
+	/// 	Deletes the given entity based on entityId, together with all of its descendants set by
+	/// 	EntitySystem::SetParent.
+	/// </summary>
 	///
 	/// <param name="entityId">	The entity identifier to delete. </param>
 	///
@@ -711,55 +2502,63 @@ public:
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	bool DeleteEntity( IN entity_t entityId ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::DeleteEntity" );
 
-		if( entitySystem.Delete( entityId ) ) 
-		{
-			component_vector components;
-			GetComponentsByEntity( entityId, components );
+		if( !entitySystem.HasChildren( entityId ) )
+			return DeleteSingleEntity( entityId );
 
-			// erase from family map
-			for( entity_t i = 0; i< components.size(); i++ ) {
+		// children are deleted before their parents, deepest first
+		entity_array& entities = mDeletedEntities;
+		entitySystem.GetDescendants( entityId, entities, true );
+		for( size_t i = entities.size(); i > 0; i-- )
+			DeleteSingleEntity( entities[ i-1 ] );
+		entities.clear();
+		return true;
+	}
 
-				mErasedIds.push_back( components[i]->mUniqueId );
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Deletes all components of given entity. Entity itself is kept. </summary>
+	///
+	/// <param name="entityId">	The entity identifier. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-				family_t componentFamily	= components[i]->mFamilyId;
-				entity_t uniqueId			= components[i]->mUniqueId;
+	void DeleteComponentsByEntity( IN entity_t entityId ) {
+		ECS_TRACE_SCOPE( "ComponentSystem::DeleteComponentsByEntity" );
 
-				for( size_t i = 0; i<mFamilyComponentMap[ componentFamily ].size(); i++ ){
-					if( mFamilyComponentMap[ componentFamily ][i]->mUniqueId == uniqueId ) {
-						mFamilyComponentMap[ componentFamily ].erase(mFamilyComponentMap[ componentFamily ].begin()+i);
-					}
-				}
+		if( entityId >= mEntityComponentArray.size() )
+			return;
 
-				if( mFamilyComponentMap[ componentFamily ].empty() )
-					mFamilyComponentMap.erase( componentFamily );
-			}
+		// take over entity's components, entity gets scratch container's capacity in return
+		component_vector& components = mDeletedComponents;
+		components.swap( mEntityComponentArray[ entityId ] );
 
-			mEntityComponentArray[entityId].clear();
+		// erase from family map
+		for( entity_t i = 0; i< components.size(); i++ ) {
 
-			for( entity_t i = 0; i< components.size(); i++ ) {
-				mComponentArray[ components[i]->mUniqueId ].reset();
-			}
+			mIds.Release( components[i]->mUniqueId );
+			EraseFromFamily( components[i] );
+		}
 
-			// check if last items are erased, if so, reduce array size
-			while( mComponentArray.empty() || (mComponentArray.back() == false) ) {
-				size_t lastId = mComponentArray.size()-1;
-				mComponentArray.pop_back();
-
-				// also check if there is such a UID in erased ID's list
-				for( entity_list::iterator it = mErasedIds.begin(); it!=mErasedIds.end(); ++it ) {
-					if( *it == lastId )
-					{
-						mErasedIds.erase( it );
-						break;
-					}
-				}
-			}
+		for( entity_t i = 0; i< components.size(); i++ )
+			OnFamilyRemoved( entityId, components[i]->mFamilyId );
 
-			return true;
+		for( entity_t i = 0; i< components.size(); i++ ) {
+			mComponentArray[ components[i]->mUniqueId ].reset();
 		}
+		components.clear();
 
-		return false;
+		// check if last items are erased, if so, reduce array size
+		mComponentArray.resize( mIds.Trim() );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Sets residency hook. Hook is not owned by component system. </summary>
+	///
+	/// <param name="residency">	Residency hook, or NULL to remove it. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void SetResidency( EntityResidency* residency ) {
+		mResidency = residency;
 	}
 protected:
 	template<typename Type>	ComponentPtr DuplicateComponent( IN entity_t newEntityId, IN ComponentPtr& sourceComponent ) {
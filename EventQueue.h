@@ -0,0 +1,210 @@
+#pragma once
+
+#include "ComponentSystem.h"
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Type erased event channel, used by event bus for swapping all channels at once. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class EventChannelBase {
+public:
+	virtual ~EventChannelBase() {}
+	virtual void Swap() = 0;
+	virtual void Clear() = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Double buffered, contiguous queue of events of one type. Events pushed during a tick are
+/// 	readable after Swap, as single contiguous array, during the whole next tick. Push may be
+/// 	called from many threads at once, it only reserves slot with one atomic increment. Events
+/// 	above capacity go to mutex guarded overflow, and capacity grows to fit them on next tick.
+/// 	Swap must not run concurrently with Push, call it between ticks.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename Event> class EventChannel : public EventChannelBase {
+	std::vector< Event >	mWrite;
+	std::atomic< size_t >	mWriteCount;
+
+	std::mutex				mOverflowMutex;
+	std::vector< Event >	mOverflow;
+
+	std::vector< Event >	mRead;
+public:
+	EventChannel( IN size_t capacity = 1024 ) : mWrite( capacity ), mWriteCount( 0 ) {}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Appends event to queue. Thread safe. </summary>
+	/// <param name="event">	The event. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Push( IN Event& event ) {
+		size_t index = mWriteCount.fetch_add( 1, std::memory_order_relaxed );
+		if( index < mWrite.size() ) {
+			mWrite[ index ] = event;
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock( mOverflowMutex );
+		mOverflow.push_back( event );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Appends batch of events to queue with single atomic increment. Thread safe. </summary>
+	/// <param name="events">	Events. </param>
+	/// <param name="count"> 	Number of events. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Push( IN Event* events, IN size_t count ) {
+		size_t index = mWriteCount.fetch_add( count, std::memory_order_relaxed );
+		size_t fits = index < mWrite.size() ? std::min( count, mWrite.size() - index ) : 0;
+
+		// destination is only valid while index is within write buffer
+		if( fits > 0 )
+			std::copy( events, events + fits, mWrite.begin() + index );
+		if( fits < count ) {
+			std::lock_guard<std::mutex> lock( mOverflowMutex );
+			mOverflow.insert( mOverflow.end(), events + fits, events + count );
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Makes events pushed since last swap readable, and starts empty write buffer. Events read
+	/// 	during previous tick are dropped.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	virtual void Swap() {
+		size_t capacity = mWrite.size();
+		size_t count = std::min( mWriteCount.load(), capacity );
+
+		mWrite.resize( count );
+		mWrite.insert( mWrite.end(), mOverflow.begin(), mOverflow.end() );
+		mRead.swap( mWrite );
+
+		// grow so next tick's events don't overflow
+		capacity = std::max( capacity, mRead.size() );
+		mWrite.clear();
+		mWrite.resize( capacity );
+		mOverflow.clear();
+		mWriteCount.store( 0 );
+	}
+
+	virtual void Clear() {
+		mWriteCount.store( 0 );
+		mOverflow.clear();
+		mRead.clear();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Calls function for consecutive batches of readable events, each batch is contiguous:
+	/// 		channel.ForEachBatch( 256, []( const Damage* events, size_t count ) { ... } );
+	/// </summary>
+	/// <param name="batchSize">	Maximum number of events in one batch, 0 for single batch. </param>
+	/// <param name="function"> 	Function called with pointer to events and their count. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Function> void ForEachBatch( size_t batchSize, Function function ) const {
+		if( batchSize == 0 )
+			batchSize = mRead.size();
+
+		for( size_t i = 0; i < mRead.size(); i += batchSize )
+			function( &mRead[i], std::min( batchSize, mRead.size() - i ) );
+	}
+
+	const std::vector< Event >& Read() const	{ return mRead; }
+	const Event* Data() const					{ return mRead.empty() ? NULL : &mRead[0]; }
+	size_t Size() const							{ return mRead.size(); }
+	bool Empty() const							{ return mRead.empty(); }
+	size_t Capacity() const						{ return mWrite.size(); }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Event bus. Holds one channel per event type. Channels must be registered before systems
+/// 	start pushing from multiple threads. Swap is called once per tick, e.g. as exclusive
+/// 	scheduled system:
+/// 		bus.Register<Damage>( 4096 );
+/// 		scheduler.Add( "events", [&]() { bus.Swap(); } )->Exclusive();
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class EventBus {
+	std::vector< EventChannelBase* >	mChannels;
+
+	static size_t NextTypeIndex() {
+		static std::atomic< size_t > next( 0 );
+		return next++;
+	}
+
+	template<typename Event> static size_t TypeIndex() {
+		static size_t index = NextTypeIndex();
+		return index;
+	}
+
+	// queues are owned by bus
+	EventBus( IN EventBus& );
+	EventBus& operator=( IN EventBus& );
+public:
+	EventBus() {}
+	~EventBus() {
+		for( size_t i = 0; i < mChannels.size(); i++ )
+			delete mChannels[i];
+		mChannels.clear();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Registers channel of given event type. Not thread safe. </summary>
+	/// <param name="capacity">	Initial capacity of channel. </param>
+	/// <returns>	The channel. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Event> EventChannel<Event>& Register( IN size_t capacity = 1024 ) {
+		size_t index = TypeIndex<Event>();
+		if( index >= mChannels.size() )
+			mChannels.resize( index + 1, NULL );
+		if( mChannels[ index ] == NULL )
+			mChannels[ index ] = new EventChannel<Event>( capacity );
+		return *static_cast< EventChannel<Event>* >( mChannels[ index ] );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Gets channel of given event type. Channel which was not registered yet is registered with
+	/// 	default capacity, which is not thread safe, so register channels up front when pushing
+	/// 	from multiple threads.
+	/// </summary>
+	/// <returns>	The channel. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Event> EventChannel<Event>& Channel() {
+		size_t index = TypeIndex<Event>();
+		if( index >= mChannels.size() || mChannels[ index ] == NULL )
+			return Register<Event>();
+		return *static_cast< EventChannel<Event>* >( mChannels[ index ] );
+	}
+
+	template<typename Event> void Push( IN Event& event ) {
+		Channel<Event>().Push( event );
+	}
+
+	void Swap() {
+		for( size_t i = 0; i < mChannels.size(); i++ )
+			if( mChannels[i] )
+				mChannels[i]->Swap();
+	}
+
+	void Clear() {
+		for( size_t i = 0; i < mChannels.size(); i++ )
+			if( mChannels[i] )
+				mChannels[i]->Clear();
+	}
+};
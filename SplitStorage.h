@@ -0,0 +1,149 @@
+#pragma once
+
+#include "ComponentSystem.h"
+
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Split family. Component type split into hot part, touched by every family scan, and cold
+/// 	part, read only on demand. Both parts are stored in separate dense arrays indexed by same
+/// 	row, so scans over hot array never pull cold data into cache. Rows of enabled entities are
+/// 	kept in front, so scans stop at EnabledSize to skip disabled ones.
+/// 		struct UnitHot  { int x, y; };
+/// 		struct UnitCold { std::string name; std::string description; };
+///
+/// 		SplitFamily<UnitHot, UnitCold>* units = RegisterStorage( new SplitFamily<UnitHot, UnitCold>( CFID_UNIT ) );
+/// 		CreateRow( entityId, CFID_UNIT );
+/// 		units->GetCold( entityId ).name = "Sherman";
+///
+/// 		UnitHot* hot = units->HotRows();
+/// 		for( size_t i = 0; i < units->EnabledSize(); i++ )
+/// 			hot[i].x++;
+/// 	Rows are not components, so Get, FindFirstComponentByEntityAndFamily and
+/// 	GetComponentsByEntity don't see them. Use FindStorageByEntityAndFamily instead. Rows are
+/// 	evicted with world partitions when both parts are plain data.
+/// </summary>
+///
+/// <typeparam name="Hot"> 	Type of hot part, default constructible. </typeparam>
+/// <typeparam name="Cold">	Type of cold part, default constructible. </typeparam>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename Hot, typename Cold> class SplitFamily : public FamilyStorage {
+	std::vector< Hot >		mHot;
+	std::vector< Cold >		mCold;
+
+	FamilyRows				mRows;
+
+	void SwapRows( IN size_t a, IN size_t b ) {
+		std::swap( mHot[a], mHot[b] );
+		std::swap( mCold[a], mCold[b] );
+	}
+
+	typedef std::integral_constant< bool, std::is_trivially_copyable< Hot >::value && std::is_trivially_copyable< Cold >::value > plain_parts;
+
+	// parts are stored as raw bytes, only when both are plain data
+	bool WriteParts( IN size_t row, std::ostream& stream, std::true_type ) const {
+		stream.write( reinterpret_cast<const char*>( &mHot[ row ] ), sizeof( Hot ) );
+		stream.write( reinterpret_cast<const char*>( &mCold[ row ] ), sizeof( Cold ) );
+		return !stream.fail();
+	}
+	bool ReadParts( IN size_t row, std::istream& stream, std::true_type ) {
+		stream.read( reinterpret_cast<char*>( &mHot[ row ] ), sizeof( Hot ) );
+		stream.read( reinterpret_cast<char*>( &mCold[ row ] ), sizeof( Cold ) );
+		return !stream.fail();
+	}
+	bool WriteParts( IN size_t, std::ostream&, std::false_type ) const	{ return false; }
+	bool ReadParts( IN size_t, std::istream&, std::false_type )		{ return false; }
+public:
+	SplitFamily( IN family_t familyId ) : FamilyStorage( familyId ) {}
+
+	virtual bool Insert( IN entity_t entityId ) {
+		if( Contains( entityId ) )
+			return false;
+
+		mHot.push_back( Hot() );
+		mCold.push_back( Cold() );
+		mRows.Insert( entityId, [this]( size_t a, size_t b ) { SwapRows( a, b ); } );
+		return true;
+	}
+
+	virtual bool Remove( IN entity_t entityId ) {
+		if( !Contains( entityId ) )
+			return false;
+
+		mRows.Remove( entityId, [this]( size_t a, size_t b ) { SwapRows( a, b ); } );
+		mHot.pop_back();
+		mCold.pop_back();
+		return true;
+	}
+
+	virtual void SetEnabled( IN entity_t entityId, IN bool enabled ) {
+		mRows.SetEnabled( entityId, enabled, [this]( size_t a, size_t b ) { SwapRows( a, b ); } );
+	}
+
+	virtual bool Contains( IN entity_t entityId ) const {
+		return mRows.Contains( entityId );
+	}
+
+	virtual size_t Size() const {
+		return mRows.Size();
+	}
+
+	virtual void Reserve( IN size_t rows ) {
+		mHot.reserve( rows );
+		mCold.reserve( rows );
+		mRows.Reserve( rows );
+	}
+
+	virtual void Clear() {
+		mHot.clear();
+		mCold.clear();
+		mRows.Clear();
+	}
+
+	virtual const entity_array& Entities() const {
+		return mRows.Entities();
+	}
+
+	// derived family overrides these when parts are not plain data
+	virtual bool WriteRow( IN entity_t entityId, std::ostream& stream ) const {
+		return WriteParts( mRows.Row( entityId ), stream, plain_parts() );
+	}
+
+	virtual bool ReadRow( IN entity_t entityId, std::istream& stream ) {
+		return ReadParts( mRows.Row( entityId ), stream, plain_parts() );
+	}
+
+	virtual size_t MemoryBytes() const {
+		return mHot.capacity() * sizeof( Hot ) + mCold.capacity() * sizeof( Cold ) + mRows.MemoryBytes();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Gets hot or cold part of given entity. Entity must have row in this family. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	Hot& GetHot( IN entity_t entityId )		{ return mHot[ mRows.Row( entityId ) ]; }
+	Cold& GetCold( IN entity_t entityId )	{ return mCold[ mRows.Row( entityId ) ]; }
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Finds hot or cold part of given entity. </summary>
+	/// <returns>	Part, or NULL if entity has no row in this family. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	Hot* FindHot( IN entity_t entityId )	{ return Contains( entityId ) ? &GetHot( entityId ) : NULL; }
+	Cold* FindCold( IN entity_t entityId )	{ return Contains( entityId ) ? &GetCold( entityId ) : NULL; }
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Gets hot parts of all rows, entity of each row is given by Entities. First EnabledSize
+	/// 	rows belong to enabled entities.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	Hot* HotRows()							{ return mHot.empty() ? NULL : &mHot[0]; }
+	Cold& ColdAt( IN size_t row )			{ return mCold[ row ]; }
+	size_t EnabledSize() const				{ return mRows.EnabledSize(); }
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "ComponentSystem.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Coroutine systems. Long running system is written as C++20 coroutine, which yields once its
+/// 	time budget for current tick is used up, and continues where it stopped on next tick.
+/// 	Iteration state is kept in cursors, which remember identifiers instead of container
+/// 	positions, so they stay valid while entities and components are created and deleted
+/// 	between ticks:
+/// 		scheduler.Add( "fov", CoroutineSystem( 2.0, [&]() -> SystemTask {
+/// 			FamilyCursor cursor( system, CFID_SIGHT );
+/// 			while( Component* sight = cursor.Next() ) {
+/// 				UpdateFov( sight );
+/// 				co_await TickBudget();
+/// 			}
+/// 		} ) )->Exclusive();
+/// 	Available only when compiler supports coroutines.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined( __cpp_impl_coroutine )
+
+#include <coroutine>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+/// <summary>	Awaited to yield only if time budget of current tick is used up. </summary>
+struct TickBudget {};
+
+/// <summary>	Awaited to yield until next tick unconditionally. </summary>
+struct NextTick {};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Coroutine of system. Coroutine is suspended when created, and runs only within Resume. Only
+/// 	TickBudget and NextTick may be awaited in it.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class SystemTask {
+public:
+	struct promise_type {
+		std::chrono::steady_clock::time_point	deadline;
+
+		struct BudgetAwaiter {
+			bool ready;
+			bool await_ready() const noexcept				{ return ready; }
+			void await_suspend( std::coroutine_handle<> ) noexcept	{}
+			void await_resume() const noexcept				{}
+		};
+
+		SystemTask get_return_object()					{ return SystemTask( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+		std::suspend_always initial_suspend() noexcept	{ return std::suspend_always(); }
+		std::suspend_always final_suspend() noexcept	{ return std::suspend_always(); }
+		void return_void()								{}
+
+		// exception escapes from Resume, coroutine is finished afterwards
+		void unhandled_exception()						{ throw; }
+
+		BudgetAwaiter await_transform( TickBudget ) {
+			BudgetAwaiter awaiter = { std::chrono::steady_clock::now() < deadline };
+			return awaiter;
+		}
+
+		std::suspend_always await_transform( NextTick ) {
+			return std::suspend_always();
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type>	mHandle;
+
+	explicit SystemTask( std::coroutine_handle<promise_type> handle ) : mHandle( handle ) {}
+
+	// coroutine frame is owned by task
+	SystemTask( IN SystemTask& );
+	SystemTask& operator=( IN SystemTask& );
+public:
+	SystemTask() : mHandle( NULL ) {}
+	SystemTask( SystemTask&& other ) noexcept : mHandle( other.mHandle ) { other.mHandle = NULL; }
+
+	SystemTask& operator=( SystemTask&& other ) noexcept {
+		if( this != &other ) {
+			if( mHandle )
+				mHandle.destroy();
+			mHandle = other.mHandle;
+			other.mHandle = NULL;
+		}
+		return *this;
+	}
+
+	~SystemTask() {
+		if( mHandle )
+			mHandle.destroy();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Runs coroutine until it yields or finishes. </summary>
+	/// <param name="budget">	Time budget in milliseconds, checked by awaiting TickBudget. </param>
+	/// <returns>	true if coroutine is finished. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool Resume( IN double budget ) {
+		if( Done() )
+			return true;
+
+		mHandle.promise().deadline = std::chrono::steady_clock::now() +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double, std::milli>( budget ) );
+		mHandle.resume();
+		return mHandle.done();
+	}
+
+	bool Valid() const	{ return mHandle != NULL; }
+	bool Done() const	{ return mHandle == NULL || mHandle.done(); }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	System function running coroutine within time budget. Each call resumes coroutine, and
+/// 	once coroutine finishes, next call starts new pass. Copies share same coroutine, so it can
+/// 	be registered with SystemScheduler directly.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CoroutineSystem {
+	struct State {
+		std::function<SystemTask()>	start;
+		SystemTask					task;
+		double						budget;
+		size_t						passes;
+	};
+
+	std::shared_ptr< State >	mState;
+public:
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Constructor. </summary>
+	/// <param name="budget">	Time budget of each tick in milliseconds. </param>
+	/// <param name="start"> 	Function starting coroutine of one pass. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	CoroutineSystem( IN double budget, IN std::function<SystemTask()>& start ) : mState( std::make_shared<State>() ) {
+		mState->start	= start;
+		mState->budget	= budget;
+		mState->passes	= 0;
+	}
+
+	void operator()() {
+		State& state = *mState;
+		if( state.task.Done() )
+			state.task = state.start();
+
+		if( state.task.Resume( state.budget ) )
+			state.passes++;
+	}
+
+	/// <summary>	Number of finished passes. </summary>
+	size_t Passes() const					{ return mState->passes; }
+	double Budget() const					{ return mState->budget; }
+	void SetBudget( IN double budget )		{ mState->budget = budget; }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Cursor over family. Remembers entity and unique id of last visited component, and continues
+/// 	after it, so components deleted meanwhile are never visited, and components created behind
+/// 	cursor are visited in same pass. Families are walked in entity order with binary search on
+/// 	each step, so family kept in insertion order is switched to sorted order when cursor is
+/// 	created, which has to happen in exclusive system. Deferred family is searched linearly
+/// 	while it waits for SortFamilies.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class FamilyCursor {
+	ComponentSystem&	mSystem;
+	family_t			mFamilyId;
+	entity_t			mEntityId;
+	cid_t				mUniqueId;
+public:
+	FamilyCursor( ComponentSystem& system, IN family_t familyId ) : mSystem( system ), mFamilyId( familyId ), mEntityId( 0 ), mUniqueId( 0 ) {
+		if( mSystem.GetFamilyOrder( mFamilyId ) == FAMILY_ORDER_INSERTION )
+			mSystem.SetFamilyOrder( mFamilyId, FAMILY_ORDER_SORTED );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Advances to next component. Returned pointer holds no reference, so it doesn't keep
+	/// 	component alive across yields.
+	/// </summary>
+	/// <returns>	Next component, NULL at end of family. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	Component* Next() {
+		Component* component = mSystem.FindNextComponentByFamily( mFamilyId, mEntityId, mUniqueId ).get();
+		if( component ) {
+			mEntityId = component->mEntityId;
+			mUniqueId = component->mUniqueId;
+		}
+		return component;
+	}
+
+	void Reset() {
+		mEntityId = 0;
+		mUniqueId = 0;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Cursor over query. Walks dense entity array of query, and remembers position and entity
+/// 	last visited. Entities added meanwhile are appended, so they are visited in same pass, and
+/// 	removed ones are never visited. Removal fills hole with last entity, so when entity behind
+/// 	cursor leaves query, last entity moved behind cursor is skipped in this pass if it wasn't
+/// 	visited yet. Query must stay registered while cursor is used.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class QueryCursor {
+	ComponentQuery*		mQuery;
+	size_t				mPosition;
+	entity_t			mLast;
+public:
+	QueryCursor( ComponentQuery* query ) : mQuery( query ), mPosition( 0 ), mLast( 0 ) {}
+
+	/// <returns>	Next entity in query, 0 at end. </returns>
+	entity_t Next() {
+		const entity_array& entities = mQuery->Entities();
+
+		// last visited entity moves only backward, once it is at the end of array, otherwise it was
+		// removed and entity at its place was moved there from the end, its id may be reused since
+		if( mPosition > entities.size() )
+			mPosition = entities.size();
+		else if( mPosition > 0 && entities[ mPosition - 1 ] != mLast && ( !mQuery->Contains( mLast ) || mQuery->Position( mLast ) >= mPosition ) )
+			mPosition--;
+
+		if( mPosition == entities.size() )
+			return 0;
+
+		mLast = entities[ mPosition++ ];
+		return mLast;
+	}
+
+	void Reset() {
+		mPosition	= 0;
+		mLast		= 0;
+	}
+};
+
+#endif
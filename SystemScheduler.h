@@ -0,0 +1,333 @@
+#pragma once
+
+#include "ComponentSystem.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	System registered with a scheduler. Each system declares which families it reads and which
+/// 	it writes. Two systems conflict if one of them writes a family the other one reads or writes.
+/// 	Conflicting systems are always executed in registration order, non-conflicting systems may
+/// 	run in parallel.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ScheduledSystem {
+	friend class SystemScheduler;
+
+	std::string				mName;
+	const char*				mTraceName;
+	std::function<void()>	mUpdate;
+	std::vector<family_t>	mReads;
+	std::vector<family_t>	mWrites;
+	bool					mExclusive;
+	bool					mDirty;
+
+	// dependency graph, rebuilt by scheduler when declarations change
+	std::vector<size_t>		mDependents;
+	size_t					mDependencyCount;
+	size_t					mPending;
+
+	// timing of last run and running total, in milliseconds
+	double					mLastTime;
+	double					mTotalTime;
+	size_t					mRuns;
+
+	ScheduledSystem( IN std::string& name, IN std::function<void()>& update ) :
+		mName( name ), mTraceName( ECS_TRACE_INTERN( name ) ), mUpdate( update ), mExclusive( false ), mDirty( true ),
+		mDependencyCount( 0 ), mPending( 0 ), mLastTime( 0 ), mTotalTime( 0 ), mRuns( 0 ) {}
+
+	static bool Contains( IN std::vector<family_t>& families, IN family_t familyId ) {
+		for( size_t i = 0; i < families.size(); i++ )
+			if( families[i] == familyId )
+				return true;
+		return false;
+	}
+
+	static bool Intersects( IN std::vector<family_t>& a, IN std::vector<family_t>& b ) {
+		for( size_t i = 0; i < a.size(); i++ )
+			if( Contains( b, a[i] ) )
+				return true;
+		return false;
+	}
+public:
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Declares family as read by this system. </summary>
+	/// <param name="familyId">	Identifier for the family. </param>
+	/// <returns>	This instance. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ScheduledSystem* Reads( IN family_t familyId ) {
+		if( !Contains( mReads, familyId ) )
+			mReads.push_back( familyId );
+		mDirty = true;
+		return this;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Declares family as written by this system. </summary>
+	/// <param name="familyId">	Identifier for the family. </param>
+	/// <returns>	This instance. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ScheduledSystem* Writes( IN family_t familyId ) {
+		if( !Contains( mWrites, familyId ) )
+			mWrites.push_back( familyId );
+		mDirty = true;
+		return this;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Marks system as exclusive. Exclusive system conflicts with every other system. Use it for
+	/// 	systems that create or delete entities and components, since component system containers
+	/// 	are not thread safe. Systems running in parallel may only modify component data and
+	/// 	storage rows of families they write, and call only these component system functions:
+	/// 		GetComponentsByEntity, GetComponentsByEntityAndFamily, FindFirstComponentByEntityAndFamily,
+	/// 		Get, GetComponentsByFamily, GetComponentsByFamilyAndEntity, FindFirstComponentByFamily,
+	/// 		FindNextComponentByFamily, JoinFamilies, GetEntitiesByTag, CountEntitiesByTag,
+	/// 		HasTag, IsEnabled, GetStorage and iteration of registered queries.
+	/// 	Entity lookups load evicted partitions of WorldStreamer, so they need exclusive system
+	/// 	while any partition is evicted. Creating, deleting, tagging, enabling, registering queries
+	/// 	and SortFamilies always do.
+	/// </summary>
+	/// <returns>	This instance. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ScheduledSystem* Exclusive() {
+		mExclusive = true;
+		mDirty = true;
+		return this;
+	}
+
+	bool ConflictsWith( IN ScheduledSystem& other ) const {
+		if( mExclusive || other.mExclusive )
+			return true;
+
+		return	Intersects( mWrites, other.mWrites ) ||
+				Intersects( mWrites, other.mReads ) ||
+				Intersects( mReads, other.mWrites );
+	}
+
+	const std::string& Name() const		{ return mName; }
+	double LastTime() const				{ return mLastTime; }
+	double TotalTime() const			{ return mTotalTime; }
+	double AverageTime() const			{ return mRuns ? mTotalTime / mRuns : 0; }
+	size_t Runs() const					{ return mRuns; }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	System scheduler. Builds dependency graph from read/write family declarations and runs every
+/// 	registered system once per tick on a thread pool. Results are deterministic: each system
+/// 	observes exactly the same data it would observe when all systems are run sequentially in
+/// 	registration order.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class SystemScheduler {
+	std::vector<ScheduledSystem*>	mSystems;
+	std::vector<std::thread>		mWorkers;
+
+	std::mutex						mMutex;
+	std::condition_variable			mWakeUp;
+	std::deque<size_t>				mReady;
+	size_t							mCompleted;
+	size_t							mTick;
+	bool							mRunning;
+	bool							mShutdown;
+
+	double							mLastTickTime;
+
+	void BuildGraph() {
+		for( size_t i = 0; i < mSystems.size(); i++ ) {
+			mSystems[i]->mDependents.clear();
+			mSystems[i]->mDependencyCount = 0;
+			mSystems[i]->mDirty = false;
+		}
+
+		// edge from every earlier system to every later conflicting one keeps registration order
+		for( size_t i = 0; i < mSystems.size(); i++ ) {
+			for( size_t j = i+1; j < mSystems.size(); j++ ) {
+				if( mSystems[i]->ConflictsWith( *mSystems[j] ) ) {
+					mSystems[i]->mDependents.push_back( j );
+					mSystems[j]->mDependencyCount++;
+				}
+			}
+		}
+	}
+
+	bool GraphDirty() const {
+		for( size_t i = 0; i < mSystems.size(); i++ )
+			if( mSystems[i]->mDirty )
+				return true;
+		return false;
+	}
+
+	void Execute( IN size_t index ) {
+		ScheduledSystem* system = mSystems[ index ];
+		ECS_TRACE_SCOPE( system->mTraceName );
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		system->mUpdate();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		system->mLastTime = elapsed.count();
+		system->mTotalTime += system->mLastTime;
+		system->mRuns++;
+	}
+
+	// run ready systems until whole tick is completed. Caller must hold the lock.
+	void Drain( std::unique_lock<std::mutex>& lock ) {
+		while( mRunning && !mReady.empty() ) {
+			size_t index = mReady.front();
+			mReady.pop_front();
+
+			lock.unlock();
+			Execute( index );
+			lock.lock();
+
+			ScheduledSystem* system = mSystems[ index ];
+			for( size_t i = 0; i < system->mDependents.size(); i++ ) {
+				size_t dependent = system->mDependents[i];
+				if( --mSystems[ dependent ]->mPending == 0 )
+					mReady.push_back( dependent );
+			}
+
+			if( ++mCompleted == mSystems.size() )
+				mRunning = false;
+
+			// wakes workers for new ready systems, and calling thread once tick is over
+			if( !mRunning || !mReady.empty() )
+				mWakeUp.notify_all();
+		}
+	}
+
+	void WorkerLoop() {
+		std::unique_lock<std::mutex> lock( mMutex );
+		while( !mShutdown ) {
+			Drain( lock );
+			mWakeUp.wait( lock );
+		}
+	}
+public:
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Constructor. </summary>
+	/// <param name="threads">
+	/// 	Number of threads used for running systems, including calling thread. 0 uses number of
+	/// 	hardware threads, 1 runs all systems sequentially on calling thread.
+	/// </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	SystemScheduler( size_t threads = 0 ) : mCompleted( 0 ), mTick( 0 ), mRunning( false ), mShutdown( false ), mLastTickTime( 0 ) {
+		if( threads == 0 )
+			threads = std::thread::hardware_concurrency();
+
+		for( size_t i = 1; i < threads; i++ )
+			mWorkers.push_back( std::thread( &SystemScheduler::WorkerLoop, this ) );
+	}
+
+	~SystemScheduler() {
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mShutdown = true;
+		}
+		mWakeUp.notify_all();
+
+		for( size_t i = 0; i < mWorkers.size(); i++ )
+			mWorkers[i].join();
+
+		for( size_t i = 0; i < mSystems.size(); i++ )
+			delete mSystems[i];
+		mSystems.clear();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Registers new system. Families are declared on returned system:
+	/// 		scheduler.Add( "battle", update )
+	/// 			->	Reads( CFID_ATTACK )
+	/// 			->	Writes( CFID_HEALTH );
+	/// </summary>
+	/// <param name="name">  	System name, used for timing reports. </param>
+	/// <param name="update">	Function called once per tick. </param>
+	/// <returns>	Registered system, owned by scheduler. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ScheduledSystem* Add( IN std::string& name, IN std::function<void()>& update ) {
+		ScheduledSystem* system = new ScheduledSystem( name, update );
+		mSystems.push_back( system );
+		return system;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Runs every registered system once. Returns when all of them are finished. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Run() {
+		if( mSystems.empty() )
+			return;
+
+		ECS_TRACE_SCOPE( "SystemScheduler::Run" );
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		std::unique_lock<std::mutex> lock( mMutex );
+
+		if( GraphDirty() )
+			BuildGraph();
+
+		mReady.clear();
+		mCompleted = 0;
+		for( size_t i = 0; i < mSystems.size(); i++ ) {
+			mSystems[i]->mPending = mSystems[i]->mDependencyCount;
+			if( mSystems[i]->mPending == 0 )
+				mReady.push_back( i );
+		}
+
+		mRunning = true;
+		mTick++;
+		mWakeUp.notify_all();
+
+		// calling thread works as well until there is nothing left to run
+		while( mRunning ) {
+			Drain( lock );
+			if( mRunning )
+				mWakeUp.wait( lock );
+		}
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		mLastTickTime = elapsed.count();
+	}
+
+	ScheduledSystem* GetSystem( IN size_t index )	{ return mSystems[ index ]; }
+	size_t Size() const								{ return mSystems.size(); }
+	size_t Tick() const								{ return mTick; }
+	size_t ThreadCount() const						{ return mWorkers.size() + 1; }
+	double LastTickTime() const						{ return mLastTickTime; }
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Dumps timing of every system. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void DumpTimings() {
+		std::cout << "--- System timings (ms) ---" << std::endl;
+		for( size_t i = 0; i < mSystems.size(); i++ ) {
+			std::cout
+				<< mSystems[i]->Name()
+				<< " last(" << mSystems[i]->LastTime() << ") "
+				<< " avg(" << mSystems[i]->AverageTime() << ") "
+				<< std::endl;
+		}
+		std::cout << "tick(" << mLastTickTime << ")" << std::endl;
+	}
+};
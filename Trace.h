@@ -0,0 +1,202 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Scoped timeline tracing. Define ECS_TRACE before including any of the headers to enable it,
+/// 	otherwise every trace macro compiles to nothing. Each thread records into its own lock-free
+/// 	ring buffer, recorded timeline is exported in Chrome trace format (chrome://tracing):
+/// 		void Update() {
+/// 			ECS_TRACE_SCOPE( "Update" );
+/// 			...
+/// 		}
+/// 		TraceRecorder::Instance().ExportChromeTrace( file );
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef ECS_TRACE
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <set>
+
+#ifndef ECS_TRACE_BUFFER_SIZE
+#define ECS_TRACE_BUFFER_SIZE	65536	// events per thread, power of two
+#endif
+
+struct TraceEvent {
+	const char*			name;
+	unsigned long long	start;		// nanoseconds since recorder was created
+	unsigned long long	duration;	// nanoseconds
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Ring buffer of one thread. Only owning thread writes into it, newest events overwrite
+/// 	oldest ones once buffer is full.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class TraceBuffer {
+	std::vector< TraceEvent >			mEvents;
+	std::atomic< unsigned long long >	mWritten;
+	unsigned int						mThreadId;
+public:
+	TraceBuffer( const unsigned int threadId ) : mEvents( ECS_TRACE_BUFFER_SIZE ), mWritten( 0 ), mThreadId( threadId ) {}
+
+	void Push( const char* name, const unsigned long long start, const unsigned long long duration ) {
+		unsigned long long index = mWritten.load( std::memory_order_relaxed );
+		TraceEvent& event = mEvents[ index & ( ECS_TRACE_BUFFER_SIZE - 1 ) ];
+		event.name		= name;
+		event.start		= start;
+		event.duration	= duration;
+		mWritten.store( index + 1, std::memory_order_release );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Copies recorded events, oldest first. Events written while copying may be torn, so export
+	/// 	while threads are idle for exact results.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Snapshot( std::vector< TraceEvent >& events ) const {
+		unsigned long long written = mWritten.load( std::memory_order_acquire );
+		unsigned long long first = written > ECS_TRACE_BUFFER_SIZE ? written - ECS_TRACE_BUFFER_SIZE : 0;
+		for( unsigned long long i = first; i < written; i++ )
+			events.push_back( mEvents[ i & ( ECS_TRACE_BUFFER_SIZE - 1 ) ] );
+	}
+
+	void Clear()					{ mWritten.store( 0, std::memory_order_release ); }
+	unsigned int ThreadId() const	{ return mThreadId; }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Trace recorder. Owns buffers of all threads which recorded any event. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class TraceRecorder {
+	std::mutex										mMutex;
+	std::vector< std::shared_ptr< TraceBuffer > >	mBuffers;
+	std::set< std::string >							mNames;
+	std::chrono::steady_clock::time_point			mEpoch;
+
+	TraceRecorder() : mEpoch( std::chrono::steady_clock::now() ) {}
+
+	static void WriteEscaped( std::ostream& stream, const char* text ) {
+		for( ; *text; text++ ) {
+			if( *text == '"' || *text == '\\' )
+				stream << '\\';
+			stream << *text;
+		}
+	}
+public:
+	static TraceRecorder& Instance() {
+		static TraceRecorder recorder;
+		return recorder;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Gets buffer of calling thread. Registration is only locked once per thread. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	TraceBuffer& ThreadBuffer() {
+		static thread_local TraceBuffer* buffer = NULL;
+		if( buffer == NULL ) {
+			std::lock_guard<std::mutex> lock( mMutex );
+			mBuffers.push_back( std::make_shared<TraceBuffer>( (unsigned int)mBuffers.size() + 1 ) );
+			buffer = mBuffers.back().get();
+		}
+		return *buffer;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Interns name built at runtime, so events can refer to it after its source is gone. Names
+	/// 	are kept until recorder is destroyed, intern each distinct name once, not per event.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	const char* Intern( const std::string& name ) {
+		std::lock_guard<std::mutex> lock( mMutex );
+		return mNames.insert( name ).first->c_str();
+	}
+
+	unsigned long long Now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - mEpoch ).count();
+	}
+
+	void Clear() {
+		std::lock_guard<std::mutex> lock( mMutex );
+		for( size_t i = 0; i < mBuffers.size(); i++ )
+			mBuffers[i]->Clear();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Exports recorded events of all threads as Chrome trace JSON. </summary>
+	/// <param name="stream">	[out] Stream receiving JSON. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void ExportChromeTrace( std::ostream& stream ) {
+		std::lock_guard<std::mutex> lock( mMutex );
+		std::vector< TraceEvent > events;
+		bool first = true;
+
+		stream << "{\"traceEvents\":[";
+		for( size_t b = 0; b < mBuffers.size(); b++ ) {
+			events.clear();
+			mBuffers[b]->Snapshot( events );
+
+			for( size_t i = 0; i < events.size(); i++ ) {
+				if( !first )
+					stream << ",";
+				first = false;
+
+				stream << "\n{\"name\":\"";
+				WriteEscaped( stream, events[i].name );
+				stream
+					<< "\",\"cat\":\"ecs\",\"ph\":\"X\",\"pid\":1"
+					<< ",\"tid\":" << mBuffers[b]->ThreadId()
+					<< ",\"ts\":" << events[i].start / 1000 << "." << ( events[i].start % 1000 ) / 100
+					<< ",\"dur\":" << events[i].duration / 1000 << "." << ( events[i].duration % 1000 ) / 100
+					<< "}";
+			}
+		}
+		stream << "\n],\"displayTimeUnit\":\"ns\"}" << std::endl;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Records one event from construction to destruction. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class TraceScope {
+	const char*			mName;
+	unsigned long long	mStart;
+public:
+	TraceScope( const char* name ) : mName( name ), mStart( TraceRecorder::Instance().Now() ) {}
+	~TraceScope() {
+		TraceRecorder& recorder = TraceRecorder::Instance();
+		recorder.ThreadBuffer().Push( mName, mStart, recorder.Now() - mStart );
+	}
+};
+
+#define ECS_TRACE_CONCAT_( a, b )	a##b
+#define ECS_TRACE_CONCAT( a, b )	ECS_TRACE_CONCAT_( a, b )
+
+/// <summary>	Traces enclosing scope. Name must outlive export, string literals are fine. </summary>
+#define ECS_TRACE_SCOPE( name )		TraceScope ECS_TRACE_CONCAT( ecsTraceScope, __LINE__ )( name )
+
+/// <summary>	Stable copy of runtime name, usable with ECS_TRACE_SCOPE. NULL when tracing is off. </summary>
+#define ECS_TRACE_INTERN( name )	TraceRecorder::Instance().Intern( name )
+
+#else
+
+#define ECS_TRACE_SCOPE( name )
+#define ECS_TRACE_INTERN( name )	NULL
+
+#endif
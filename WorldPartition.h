@@ -0,0 +1,604 @@
+#pragma once
+
+#include "ComponentSystem.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <future>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <type_traits>
+#include <cstdio>
+
+#define PARTITION_FILE_MAGIC	0x50534345	// "ECSP"
+
+/// <summary>	Entity flags stored in partition file. </summary>
+#define PARTITION_ENTITY_DISABLED	0x1
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Functions creating, writing and reading components of one family. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct FamilyCodec {
+	std::function< ComponentPtr( ComponentSystem&, entity_t ) >	create;
+	std::function< void( const Component&, std::ostream& ) >	write;
+	std::function< void( std::istream&, Component& ) >			read;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	Group of entities (level, region) whose identifiers are reserved as one range. Components of
+/// 	partition's entities can be evicted to disk and streamed back, while entity identifiers stay
+/// 	reserved, so handles remain valid.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class WorldPartition {
+	friend class WorldStreamer;
+
+	unsigned int				mId;
+	entity_t					mFirst;
+	entity_t					mCount;
+	/// <summary>	Entities used within range, as offset from first entity plus one. </summary>
+	IdPool						mLocal;
+	bool						mResident;
+	std::string					mPath;
+	size_t						mStoredBytes;
+
+	/// <summary>	Evicted data, kept in memory until background write is confirmed. </summary>
+	std::shared_ptr<std::string>	mData;
+	std::shared_future<bool>		mWrite;
+	bool							mWriteFailed;
+	std::future<std::string>		mRead;
+
+	WorldPartition( IN unsigned int id, IN entity_t first, IN entity_t count, IN std::string& path ) :
+		mId( id ), mFirst( first ), mCount( count ), mResident( true ), mPath( path ), mStoredBytes( 0 ), mWriteFailed( false ) {}
+
+	entity_t ToEntity( IN unsigned int local ) const	{ return mFirst + local - 1; }
+	unsigned int ToLocal( IN entity_t entityId ) const	{ return entityId - mFirst + 1; }
+
+	// waits for background write, evicted data is dropped from memory once it is on disk
+	bool WaitForWrite() {
+		if( mWrite.valid() ) {
+			mWriteFailed = !mWrite.get();
+			mWrite = std::shared_future<bool>();
+			if( !mWriteFailed )
+				mData.reset();
+		}
+		return !mWriteFailed;
+	}
+
+	// same as WaitForWrite, but only once write is finished
+	void PollWrite() {
+		if( mWrite.valid() && mWrite.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready )
+			WaitForWrite();
+	}
+public:
+	unsigned int Id() const							{ return mId; }
+	entity_t First() const							{ return mFirst; }
+	entity_t Count() const							{ return mCount; }
+	bool IsResident() const							{ return mResident; }
+	/// <summary>	true if last write of evicted data failed, data is then kept in memory. </summary>
+	bool WriteFailed() const						{ return mWriteFailed; }
+	size_t StoredBytes() const						{ return mStoredBytes; }
+	const std::string& Path() const					{ return mPath; }
+	entity_t EntityCount() const					{ return mLocal.Size() - 1 - mLocal.FreeCount(); }
+
+	bool Contains( IN entity_t entityId ) const {
+		return entityId >= mFirst && entityId - mFirst < mCount;
+	}
+	bool Exist( IN entity_t entityId ) const {
+		return Contains( entityId ) && mLocal.IsUsed( ToLocal( entityId ) );
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>
+/// 	World streamer. Splits entities of component system into partitions which can be evicted
+/// 	to compact binary file and lazily loaded back on first access to any of their entities.
+/// 	Files are written and prefetched on background threads, applying loaded data to component
+/// 	system always happens on calling thread. Evicted entities are not visible in family scans
+/// 	and queries until partition is loaded again. Evicted data stays in memory until its write
+/// 	is confirmed, owner of streamer calls Poll once per tick to release it.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class WorldStreamer : public EntityResidency {
+	ComponentSystem&					mSystem;
+	std::string							mDirectory;
+	std::vector< WorldPartition* >		mPartitions;
+	/// <summary>	Partitions sorted by their first entity. </summary>
+	std::vector< WorldPartition* >		mSorted;
+	std::map< family_t, FamilyCodec >	mCodecs;
+	size_t								mEvictedCount;
+
+	static bool FirstLess( IN entity_t entityId, IN WorldPartition* partition ) {
+		return entityId < partition->mFirst;
+	}
+
+	template<typename Type> static void WriteValue( std::ostream& stream, IN Type& value ) {
+		stream.write( reinterpret_cast<const char*>( &value ), sizeof( Type ) );
+	}
+
+	template<typename Type> static bool ReadValue( std::istream& stream, OUT Type& value ) {
+		return (bool)stream.read( reinterpret_cast<char*>( &value ), sizeof( Type ) );
+	}
+
+	static std::string ReadFile( IN std::string& path ) {
+		std::ifstream file( path.c_str(), std::ios::binary );
+		std::ostringstream data;
+		data << file.rdbuf();
+		return data.str();
+	}
+
+	WorldPartition* GetPartition( IN unsigned int partitionId ) {
+		if( partitionId == 0 || partitionId > mPartitions.size() )
+			return NULL;
+		return mPartitions[ partitionId - 1 ];
+	}
+
+	// removes components, tags, storage rows and disabled flag of entity, identifier stays reserved
+	void ClearEntity( IN entity_t entityId ) {
+		mSystem.DeleteComponentsByEntity( entityId );
+
+		std::vector< family_t > tags;
+		mSystem.GetTagsByEntity( entityId, tags );
+		for( size_t i = 0; i < tags.size(); i++ )
+			mSystem.RemoveTag( entityId, tags[i] );
+
+		std::vector< FamilyStorage* > storages;
+		mSystem.GetStoragesByEntity( entityId, storages );
+		for( size_t i = 0; i < storages.size(); i++ )
+			mSystem.DeleteRow( entityId, storages[i]->Family() );
+
+		mSystem.SetEnabled( entityId, true );
+	}
+
+	// reads family, size and payload of one component or storage row
+	static bool ReadRecord( std::istream& stream, OUT family_t& familyId, OUT std::string& payload ) {
+		unsigned int size = 0;
+		if( !ReadValue( stream, familyId ) || !ReadValue( stream, size ) )
+			return false;
+
+		payload.assign( size, '\0' );
+		return size == 0 || (bool)stream.read( &payload[0], size );
+	}
+
+	static void WriteRecord( std::ostream& stream, IN family_t familyId, IN std::string& payload ) {
+		WriteValue( stream, familyId );
+		WriteValue( stream, (unsigned int)payload.size() );
+		stream.write( payload.data(), payload.size() );
+	}
+
+	// checks loaded data of partition, and applies it to component system when apply is set
+	bool Parse( IN std::string& data, IN bool apply ) {
+		std::istringstream stream( data );
+
+		unsigned int magic = 0, entities = 0;
+		if( !ReadValue( stream, magic ) || magic != PARTITION_FILE_MAGIC || !ReadValue( stream, entities ) )
+			return false;
+
+		for( unsigned int e = 0; e < entities; e++ ) {
+			entity_t entityId = 0;
+			unsigned int flags = 0, tags = 0, components = 0;
+			if( !ReadValue( stream, entityId ) || !ReadValue( stream, flags ) || !ReadValue( stream, tags ) )
+				return false;
+
+			for( unsigned int t = 0; t < tags; t++ ) {
+				family_t tagId = 0;
+				if( !ReadValue( stream, tagId ) )
+					return false;
+				if( apply )
+					mSystem.AddTag( entityId, tagId );
+			}
+
+			if( !ReadValue( stream, components ) )
+				return false;
+
+			std::string payload;
+			for( unsigned int c = 0; c < components; c++ ) {
+				family_t familyId = 0;
+				if( !ReadRecord( stream, familyId, payload ) )
+					return false;
+
+				std::map< family_t, FamilyCodec >::iterator codec = mCodecs.find( familyId );
+				if( !apply || codec == mCodecs.end() )
+					continue;
+
+				std::istringstream payloadStream( payload );
+				ComponentPtr component = codec->second.create( mSystem, entityId );
+				if( component )
+					codec->second.read( payloadStream, *component );
+			}
+
+			unsigned int rows = 0;
+			if( !ReadValue( stream, rows ) )
+				return false;
+
+			for( unsigned int r = 0; r < rows; r++ ) {
+				family_t familyId = 0;
+				if( !ReadRecord( stream, familyId, payload ) )
+					return false;
+
+				FamilyStorage* storage = mSystem.GetStorage< FamilyStorage >( familyId );
+				if( !apply || storage == NULL )
+					continue;
+
+				std::istringstream payloadStream( payload );
+				if( mSystem.CreateRow( entityId, familyId ) )
+					storage->ReadRow( entityId, payloadStream );
+			}
+
+			if( apply && ( flags & PARTITION_ENTITY_DISABLED ) )
+				mSystem.SetEnabled( entityId, false );
+		}
+		return stream.peek() == std::char_traits<char>::eof();
+	}
+public:
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Constructor. Registers streamer as residency hook of component system. </summary>
+	/// <param name="system">   	Component system holding partitioned entities. </param>
+	/// <param name="directory">	Directory where evicted partitions are stored. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	WorldStreamer( ComponentSystem& system, IN std::string& directory ) : mSystem( system ), mDirectory( directory ), mEvictedCount( 0 ) {
+		mSystem.SetResidency( this );
+	}
+
+	~WorldStreamer() {
+		mSystem.SetResidency( NULL );
+
+		for( size_t i = 0; i < mPartitions.size(); i++ ) {
+			mPartitions[i]->WaitForWrite();
+			if( mPartitions[i]->mRead.valid() )
+				mPartitions[i]->mRead.wait();
+			delete mPartitions[i];
+		}
+		mPartitions.clear();
+		mSorted.clear();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Registers family with custom write and read functions. </summary>
+	///
+	/// <typeparam name="typename Type">	Type of the component. </typeparam>
+	/// <param name="familyId">	Identifier for the family. </param>
+	/// <param name="write">   	Writes component fields to stream. </param>
+	/// <param name="read">	   	Reads component fields from stream. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Type> void RegisterFamily( IN family_t familyId,
+		IN std::function< void( const Type&, std::ostream& ) >& write,
+		IN std::function< void( std::istream&, Type& ) >& read )
+	{
+		FamilyCodec& codec = mCodecs[ familyId ];
+		codec.create	= []( ComponentSystem& system, entity_t entityId ) { return system.CreateComponent<Type>( entityId ); };
+		codec.write		= [write]( const Component& component, std::ostream& stream ) { write( static_cast<const Type&>( component ), stream ); };
+		codec.read		= [read]( std::istream& stream, Component& component ) { read( stream, static_cast<Type&>( component ) ); };
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Registers family of plain data component, stored as raw bytes. </summary>
+	///
+	/// <typeparam name="typename Type">	Trivially copyable type of the component. </typeparam>
+	/// <param name="familyId">	Identifier for the family. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<typename Type> void RegisterPlainFamily( IN family_t familyId ) {
+		static_assert( std::is_trivially_copyable<Type>::value, "plain family must be trivially copyable" );
+
+		RegisterFamily<Type>( familyId,
+			[]( const Type& component, std::ostream& stream ) { WriteValue( stream, component ); },
+			[]( std::istream& stream, Type& component ) {
+				// identifiers are assigned by component system, keep them
+				Component ids = component;
+				ReadValue( stream, component );
+				static_cast<Component&>( component ) = ids;
+			} );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Creates partition and reserves its whole entity range in component system. Fails if any
+	/// 	identifier in range is already used.
+	/// </summary>
+	///
+	/// <param name="first">	First entity of range. </param>
+	/// <param name="count">	Number of entities in range. </param>
+	///
+	/// <returns>	Identifier of new partition, 0 if it fails. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	unsigned int CreatePartition( IN entity_t first, IN entity_t count ) {
+		if( first == 0 || count == 0 )
+			return 0;
+
+		for( entity_t i = 0; i < count; i++ ) {
+			if( mSystem.CreateNewEntityUnderId( first + i ) == 0 ) {
+				// roll back already reserved part of range
+				while( i-- > 0 )
+					mSystem.DeleteEntity( first + i );
+				return 0;
+			}
+		}
+
+		unsigned int id = (unsigned int)mPartitions.size() + 1;
+		std::string path = mDirectory + "/partition_" + std::to_string( (unsigned long long)id ) + ".bin";
+		WorldPartition* partition = new WorldPartition( id, first, count, path );
+
+		mPartitions.push_back( partition );
+		mSorted.insert( std::upper_bound( mSorted.begin(), mSorted.end(), first, FirstLess ), partition );
+		return id;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Creates new entity within partition. Partition is loaded if it was evicted. </summary>
+	/// <param name="partitionId">	Identifier for the partition. </param>
+	/// <returns>	New entity, 0 if partition is full or doesn't exist. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	entity_t CreateEntity( IN unsigned int partitionId ) {
+		WorldPartition* partition = GetPartition( partitionId );
+		if( partition == NULL || !Load( partitionId ) )
+			return 0;
+
+		unsigned int local = partition->mLocal.Acquire();
+		if( local > partition->mCount ) {
+			partition->mLocal.Release( local );
+			partition->mLocal.Trim();
+			return 0;
+		}
+		return partition->ToEntity( local );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Deletes entity within partition. Its components, tags and storage rows are deleted,
+	/// 	identifier stays reserved for partition.
+	/// </summary>
+	/// <param name="entityId">	The entity identifier. </param>
+	/// <returns>	true if it succeeds, false if entity doesn't exist in any partition. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool DeleteEntity( IN entity_t entityId ) {
+		WorldPartition* partition = FindPartition( entityId );
+		if( partition == NULL || !partition->Exist( entityId ) || !Load( partition->mId ) )
+			return false;
+
+		ClearEntity( entityId );
+		partition->mLocal.Release( partition->ToLocal( entityId ) );
+		partition->mLocal.Trim();
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Evicts partition. Components, tags, storage rows and enabled flag of its entities are
+	/// 	written to compact binary form and removed from component system. File is written on
+	/// 	background thread. Every component of partition must belong to registered family, and
+	/// 	every storage holding its rows must support WriteRow. Components referenced from outside
+	/// 	of component system are deleted from it as well. Evicted data stays in memory until
+	/// 	write is confirmed, and for good if it fails, see Poll and Flush.
+	/// </summary>
+	///
+	/// <param name="partitionId">	Identifier for the partition. </param>
+	///
+	/// <returns>	true if it succeeds, false if it fails. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool Evict( IN unsigned int partitionId ) {
+		ECS_TRACE_SCOPE( "WorldStreamer::Evict" );
+		WorldPartition* partition = GetPartition( partitionId );
+		if( partition == NULL )
+			return false;
+		if( !partition->mResident )
+			return true;
+
+		// prefetched data is stale once partition was loaded
+		if( partition->mRead.valid() ) {
+			partition->mRead.wait();
+			partition->mRead = std::future<std::string>();
+		}
+
+		std::ostringstream stream;
+		component_vector components;
+		std::vector< family_t > tags;
+		std::vector< FamilyStorage* > storages;
+
+		WriteValue( stream, (unsigned int)PARTITION_FILE_MAGIC );
+		WriteValue( stream, (unsigned int)partition->EntityCount() );
+
+		for( unsigned int local = 1; local < partition->mLocal.Size(); local++ ) {
+			if( !partition->mLocal.IsUsed( local ) )
+				continue;
+
+			entity_t entityId = partition->ToEntity( local );
+			mSystem.GetComponentsByEntity( entityId, components );
+
+			for( size_t i = 0; i < components.size(); i++ )
+				if( mCodecs.find( components[i]->mFamilyId ) == mCodecs.end() )
+					return false;
+
+			mSystem.GetTagsByEntity( entityId, tags );
+			unsigned int flags = mSystem.IsEnabled( entityId ) ? 0 : PARTITION_ENTITY_DISABLED;
+
+			WriteValue( stream, entityId );
+			WriteValue( stream, flags );
+			WriteValue( stream, (unsigned int)tags.size() );
+			for( size_t i = 0; i < tags.size(); i++ )
+				WriteValue( stream, tags[i] );
+
+			WriteValue( stream, (unsigned int)components.size() );
+
+			for( size_t i = 0; i < components.size(); i++ ) {
+				std::ostringstream payload;
+				mCodecs[ components[i]->mFamilyId ].write( *components[i], payload );
+				WriteRecord( stream, components[i]->mFamilyId, payload.str() );
+			}
+
+			mSystem.GetStoragesByEntity( entityId, storages );
+			WriteValue( stream, (unsigned int)storages.size() );
+
+			for( size_t i = 0; i < storages.size(); i++ ) {
+				std::ostringstream payload;
+				if( !storages[i]->WriteRow( entityId, payload ) )
+					return false;
+				WriteRecord( stream, storages[i]->Family(), payload.str() );
+			}
+		}
+		components.clear();
+
+		for( unsigned int local = 1; local < partition->mLocal.Size(); local++ )
+			if( partition->mLocal.IsUsed( local ) )
+				ClearEntity( partition->ToEntity( local ) );
+
+		std::shared_ptr<std::string> data = std::make_shared<std::string>( stream.str() );
+		std::string path = partition->mPath;
+
+		partition->WaitForWrite();
+		partition->mData		= data;
+		partition->mWriteFailed	= false;
+		partition->mStoredBytes	= data->size();
+		partition->mWrite = std::async( std::launch::async, [data, path]() {
+			std::ofstream file( path.c_str(), std::ios::binary | std::ios::trunc );
+			file.write( data->data(), data->size() );
+			file.close();
+			return !file.fail();
+		} ).share();
+
+		partition->mResident = false;
+		mEvictedCount++;
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Starts reading evicted partition on background thread, so following load doesn't block
+	/// 	on disk.
+	/// </summary>
+	/// <param name="partitionId">	Identifier for the partition. </param>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Prefetch( IN unsigned int partitionId ) {
+		WorldPartition* partition = GetPartition( partitionId );
+		if( partition == NULL || partition->mResident || partition->mRead.valid() || partition->mData )
+			return;
+
+		std::string path = partition->mPath;
+		partition->mRead = std::async( std::launch::async, [path]() {
+			return ReadFile( path );
+		} );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Waits for background write of evicted partition. Evicted data is released from memory
+	/// 	once write succeeds, and kept otherwise, so it can still be loaded.
+	/// </summary>
+	/// <param name="partitionId">	Identifier for the partition. </param>
+	/// <returns>	false if partition doesn't exist or its write failed. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool Flush( IN unsigned int partitionId ) {
+		WorldPartition* partition = GetPartition( partitionId );
+		return partition != NULL && partition->WaitForWrite();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Releases evicted data of partitions whose background write has finished, without
+	/// 	waiting for others. Called by owner of streamer once per tick.
+	/// </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void Poll() {
+		for( size_t i = 0; i < mPartitions.size(); i++ )
+			mPartitions[i]->PollWrite();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// 	Loads evicted partition, waiting for prefetch if one was started. Called automatically on
+	/// 	first access to any entity of evicted partition. Data is validated before it is applied,
+	/// 	on failure partition stays evicted and its file is kept.
+	/// </summary>
+	/// <param name="partitionId">	Identifier for the partition. </param>
+	/// <returns>	true if partition is in memory, false if it fails. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool Load( IN unsigned int partitionId ) {
+		ECS_TRACE_SCOPE( "WorldStreamer::Load" );
+		WorldPartition* partition = GetPartition( partitionId );
+		if( partition == NULL )
+			return false;
+		if( partition->mResident )
+			return true;
+
+		std::string data;
+		if( partition->mRead.valid() )
+			data = partition->mRead.get();
+		partition->WaitForWrite();
+
+		// data still in memory is used as is, file may be missing or stale
+		if( partition->mData )
+			data = *partition->mData;
+		else if( data.empty() )
+			data = ReadFile( partition->mPath );
+
+		if( !Parse( data, false ) )
+			return false;
+
+		// mark resident first, components are created through regular, hooked paths
+		partition->mResident = true;
+		mEvictedCount--;
+		Parse( data, true );
+
+		std::remove( partition->mPath.c_str() );
+		partition->mData.reset();
+		partition->mWriteFailed = false;
+		partition->mStoredBytes = 0;
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Loads every evicted partition. </summary>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void LoadAll() {
+		for( size_t i = 0; i < mPartitions.size(); i++ )
+			Load( mPartitions[i]->mId );
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/// <summary>	Searches for the partition containing given entity. </summary>
+	/// <param name="entityId">	The entity identifier. </param>
+	/// <returns>	The found partition, NULL if entity is not partitioned. </returns>
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	WorldPartition* FindPartition( IN entity_t entityId ) {
+		std::vector< WorldPartition* >::iterator it = std::upper_bound( mSorted.begin(), mSorted.end(), entityId, FirstLess );
+		if( it == mSorted.begin() )
+			return NULL;
+
+		--it;
+		return (*it)->Contains( entityId ) ? *it : NULL;
+	}
+
+	virtual void Require( IN entity_t entityId ) {
+		if( mEvictedCount == 0 )
+			return;
+
+		WorldPartition* partition = FindPartition( entityId );
+		if( partition && !partition->mResident )
+			Load( partition->mId );
+	}
+
+	WorldPartition* Partition( IN unsigned int partitionId )	{ return GetPartition( partitionId ); }
+	size_t Size() const										{ return mPartitions.size(); }
+	size_t EvictedCount() const								{ return mEvictedCount; }
+};
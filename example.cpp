@@ -4,6 +4,10 @@
 #include "stdafx.h"
 #include "ComponentSystem.h"
 #include <iostream>
+#include <cassert>
+
+// count heap allocations, to verify reserved mode below
+ECS_DEFINE_ALLOCATION_COUNTER
 
 #define CFID_HEALTH			1
 #define CFID_ARMOR			2
@@ -95,8 +99,40 @@ public:
 	}
 };
 
+// creates and deletes tanks within reserved capacity, which must not touch heap
+void CheckAllocationFree( int count ) {
+	TankFactory tankFactory;
+
+	std::vector< family_t > families;
+	families.push_back( CFID_HEALTH );
+	families.push_back( CFID_ARMOR );
+	families.push_back( CFID_ATTACK );
+	families.push_back( CFID_NAME );
+
+	tankFactory.Reserve( count, count, families );
+	tankFactory.ReserveComponents<Health>( count );
+	tankFactory.ReserveComponents<Armor>( count );
+	tankFactory.ReserveComponents<Attack>( count );
+	tankFactory.ReserveComponents<Name>( count );
+
+	// empty name fits into string's inline buffer
+	std::string name;
+	size_t before = AllocationCounter::Count();
+
+	for( int round = 0; round < 10; round++ ) {
+		for( int i = 0; i < count; i++ )
+			tankFactory.Create( name );
+		for( int i = 1; i <= count; i++ )
+			tankFactory.DeleteEntity( i );
+	}
+
+	assert( AllocationCounter::Count() == before );
+}
+
 int _tmain(int argc, _TCHAR* argv[])
 {
+	CheckAllocationFree( 100 );
+
 	TankFactory tankFactory;
 
 	// create two tanks